@@ -0,0 +1,485 @@
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <functional>
+#include <charconv>
+
+#include <malloc.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "lisp_interpreter.h"
+
+
+
+namespace {
+
+  using namespace lisp_interpreter;
+
+  struct result_t {
+    std::string name;
+    double      ns_per_op;
+    double      eval_calls_per_op;
+    double      allocs_per_op;
+  };
+
+  struct case_t;
+  using setup_t = std::function<void(case_t&)>;
+
+  struct case_t {
+    std::string                       name;
+    std::function<void(context_t&)>   op;
+    size_t                            bytes; // per op, for MB/s
+    size_t                            items; // per op, lines for the file cases
+    setup_t                           setup = {}; // builds the fixtures before the first run, may set bytes
+  };
+
+  volatile size_t sink; // keeps results of the native cases
+
+  uint64_t allocations() {
+    uint64_t ret = 0;
+    for (size_t i = 0; i < runtime_stats_t::kinds_max; i++) {
+      ret += runtime_stats.allocations(i);
+    }
+    return ret;
+  }
+
+  uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  // Warmup, then the median of 'repeats' runs of a calibrated number of ops.
+  result_t run(const case_t& c, size_t repeats) {
+    context_t ctx;
+    auto start = now();
+    c.op(ctx);
+    auto once = std::max<uint64_t>(now() - start, 1);
+    size_t iters = std::clamp<uint64_t>(50'000'000 / once, 1, 100'000);
+
+    std::vector<result_t> samples;
+    for (size_t r = 0; r < repeats; r++) {
+      context_t ctx;
+      auto allocs = allocations();
+      auto start = now();
+      for (size_t i = 0; i < iters; i++) c.op(ctx);
+      auto ns = now() - start;
+      samples.push_back({c.name, double(ns) / iters, double(ctx.metrics.eval_calls) / iters,
+          double(allocations() - allocs) / iters});
+    }
+    std::sort(samples.begin(), samples.end(), [](auto& x, auto& y) { return x.ns_per_op < y.ns_per_op; });
+    return samples[samples.size() / 2];
+  }
+
+  std::string generate_source(size_t size) {
+    std::string str;
+    for (size_t i = 0; str.size() < size; i++) {
+      auto n = std::to_string(i);
+      str += "(def value-" + n + " (lambda (x y) (if (less? x " + n + ") (+ x 1.5) \"str-" + n + "\"))) ; item\n";
+    }
+    return str;
+  }
+
+  // Shared data of several cases, built by the first selected one.
+  std::function<void()> fixture(std::function<void()> build) {
+    auto built = std::make_shared<bool>(false);
+    return [build = std::move(build), built] {
+      if (*built) return;
+      *built = true;
+      build();
+    };
+  }
+
+  setup_t uses(std::function<void()> fixture) {
+    return [fixture = std::move(fixture)](case_t&) { fixture(); };
+  }
+
+  // Fixtures are built in the setup of the cases selected by --filter.
+  std::vector<case_t> cases(env_sptr_t env) {
+    std::vector<case_t> ret;
+
+    auto source = std::make_shared<std::string>();
+    auto source_fixture = fixture([source] { *source = generate_source(1 << 20); });
+    auto source_setup = [source_fixture, source](case_t& c) {
+      source_fixture();
+      c.bytes = source->size();
+    };
+    ret.push_back({"parse", [source](context_t&) { parser_t p; p.feed(*source); p.finish(); }, 0, 0, source_setup});
+
+    auto lisp = [&ret, env](const std::string& name, const std::string& str, setup_t setup = {}) {
+      auto expr = std::make_shared<object_sptr_t>();
+      ret.push_back({name, [expr, env](context_t& ctx) { (*expr)->eval(env, ctx); }, 0, 0,
+          [expr, str, setup](case_t& c) {
+            if (setup) setup(c);
+            *expr = object_t::parse(str);
+          }});
+    };
+    auto define = [env](const std::string& str, context_t& ctx) {
+      object_t::parse(str)->eval(env, ctx);
+    };
+    lisp("fibr",       "(fibr 15)");
+    lisp("fib",        "(fib 60)");
+    lisp("range",      "(range 0 1000)");
+    lisp("foldl",      "(foldl (lambda (x acc) (+ x acc)) 0 (range 0 1000))");
+    lisp("filter",     "(filter (lambda (x) (less? x 500)) (range 0 1000))");
+    lisp("pipeline",   "(foldl (lambda (x acc) (+ x acc)) 0 (filter (lambda (x) (less? x 500)) (map (lambda (x) (* x 2)) (range 0 1000))))");
+    lisp("range_list", "(reverse (range 0 1000))");
+    std::string numbers;
+    for (size_t i = 0; i < 1000; i++) {
+      numbers += ' ';
+      numbers += std::to_string(i);
+    }
+    lisp("equal_list", "(equal? (quote (" + numbers + ")) (quote (" + numbers + ")))");
+    lisp("equal_list_hashcons", "(equal? hc-a hc-b)", uses(fixture([define] {
+      context_t ctx;
+      ctx.hash_consing = true;
+      for (auto name : {"hc-a", "hc-b"}) {
+        std::string def = "(def ";
+        def += name;
+        def += " (foldl (lambda (x acc) (cons x acc)) () (range 0 1000)))";
+        define(def, ctx);
+      }
+    })));
+    setup_t maps_1000;
+    for (size_t n : {10, 1000, 100000}) {
+      auto size = std::to_string(n);
+      auto maps = fixture([define, size] {
+        context_t ctx;
+        define("(def alist-" + size + " (foldl (lambda (i acc) (cons (cons i (cons (* i 2) ())) acc)) () (range 0 " + size + ")))", ctx);
+        define("(def map-" + size + " (to-map alist-" + size + "))", ctx);
+      });
+      auto key = std::to_string(n / 2);
+      lisp("alist_get_" + size, "(foldl (lambda (e acc) (if (equal? (head e) " + key + ") (head (tail e)) acc)) () alist-" + size + ")", uses(maps));
+      lisp("map_get_" + size, "(get map-" + size + " " + key + ")", uses(maps));
+      if (n == 1000) maps_1000 = uses(maps);
+    }
+    lisp("map_build_transient", "(to-map alist-1000)", maps_1000);
+    lisp("map_build_assoc", "(foldl (lambda (e m) (assoc m (head e) (head (tail e)))) (to-map ()) alist-1000)", maps_1000);
+    for (size_t n : {1000, 100000}) {
+      auto size = std::to_string(n);
+      auto vecs = uses(fixture([define, size] {
+        context_t ctx;
+        define("(def vec-" + size + " (vec (range 0 " + size + ")))", ctx);
+        define("(def dvec-" + size + " (vec-mul vec-" + size + " 0.5))", ctx);
+        define("(def list-" + size + " (vec-list vec-" + size + "))", ctx);
+      }));
+      auto half = std::to_string(n / 2);
+      lisp("list_sum_" + size, "(foldl (lambda (x acc) (+ x acc)) 0 list-" + size + ")", vecs);
+      ret.back().items = n;
+      lisp("vec_sum_" + size, "(vec-sum vec-" + size + ")", vecs);
+      ret.back().items = n;
+      lisp("vec_sum_double_" + size, "(vec-sum dvec-" + size + ")", vecs);
+      ret.back().items = n;
+      lisp("vec_dot_double_" + size, "(vec-dot dvec-" + size + " dvec-" + size + ")", vecs);
+      ret.back().items = n;
+      lisp("list_filter_sum_" + size, "(foldl (lambda (x acc) (+ x acc)) 0 (filter (lambda (x) (less? x " + half + ")) list-" + size + "))", vecs);
+      ret.back().items = n;
+      lisp("vec_filter_sum_" + size, "(vec-sum (vec-select vec-" + size + " (vec-less vec-" + size + " " + half + ")))", vecs);
+      ret.back().items = n;
+      lisp("vec_from_list_" + size, "(vec list-" + size + ")", vecs);
+      ret.back().items = n;
+    }
+    auto ropes = uses(fixture([define] {
+      context_t ctx;
+      define("(def piece \"" + std::string(80, 'x') + "\")", ctx);
+      for (auto name : {"rope-a", "rope-b"}) {
+        std::string def = "(def ";
+        def += name;
+        def += " (foldl (lambda (x acc) (+ acc piece)) \"\" (range 0 5000)))";
+        define(def, ctx);
+      }
+    }));
+    lisp("string_append", "(foldl (lambda (x acc) (+ acc piece)) \"\" (range 0 5000))", ropes);
+    ret.back().bytes = 5000 * 80;
+    lisp("string_append_flat", "(hash (foldl (lambda (x acc) (+ acc piece)) \"\" (range 0 5000)))", ropes);
+    ret.back().bytes = 5000 * 80;
+    lisp("string_equal_rope", "(equal? rope-a rope-b)", ropes);
+    ret.back().bytes = 5000 * 80;
+    lisp("string_slice", "(substring rope-a 1000 2000)", ropes);
+
+    auto log_text = std::make_shared<std::string>();
+    auto log_fixture = fixture([env, log_text] {
+      for (size_t i = 0; log_text->size() < (1 << 20); i++) {
+        *log_text += "2026-10-19 12:00:00 ";
+        *log_text += i % 100 ? "INFO" : "ERROR";
+        *log_text += " request id=";
+        *log_text += std::to_string(i);
+        *log_text += " path=/api/items\n";
+      }
+      env->defvar("log-text", convert_t<std::string>::from(*log_text));
+    });
+    auto log_setup = [log_fixture, log_text](case_t& c) {
+      log_fixture();
+      c.bytes = log_text->size();
+    };
+    auto native = [&ret, log_text, log_setup](const char* name, std::function<size_t(const std::string&)> f) {
+      ret.push_back({name, [log_text, f](context_t&) { sink = f(*log_text); }, 0, 0, log_setup});
+    };
+    native("scan_count_std", [](const std::string& text) { return std::count(text.begin(), text.end(), '\n'); });
+    native("scan_count", [](const std::string& text) { return scan_count(text.data(), text.size(), '\n'); });
+    native("scan_find_std", [](const std::string& text) { return text.find("request id=x"); });
+    native("scan_find_str", [](const std::string& text) { return scan_find_str(text.data(), text.size(), "request id=x"); });
+    static constexpr byte_class_t text_class = {'\n', '~', {'\x0b', '\x0c', '\r'}};
+    native("scan_class_end_std", [](const std::string& text) {
+      return std::find_if_not(text.begin(), text.end(), [](char c) { return text_class.contains(c); }) - text.begin();
+    });
+    native("scan_class_end", [](const std::string& text) { return scan_class_end(text.data(), text.size(), text_class); });
+    lisp("string_count_byte", "(string-count log-text \"\n\")", log_setup);
+    lisp("string_count_str", "(string-count log-text \"ERROR\")", log_setup);
+    lisp("string_find_miss", "(string-find log-text \"request id=x\")", log_setup);
+    lisp("string_split_lines", "(string-split log-text \"\n\")", log_setup);
+    lisp("string_replace", "(string-replace log-text \"ERROR\" \"error\")", log_setup);
+    lisp("arithmetic", "(+ (* (- 10 3) (+ 1 2)) (- (* 4 5) (+ (* 2 3) (- 9 8))))");
+    lisp("recursion",  "(ranger 0 1000)");
+    lisp("call_kernel", "(__kernel_plus 1 2)");
+    lisp("call_native", "(add 1 2)");
+    lisp("call_lambda", "((__kernel_lambda (x y) (__kernel_plus x y)) 1 2)");
+
+    static null_sink_t null_sink;
+    static fd_sink_t fd_sink(::open("/dev/null", O_WRONLY));
+    static memory_sink_t memory_sink;
+    auto print = object_t::parse("(__kernel_println 1234567 \"some text\" 2.5)");
+    for (auto [name, sink] : {std::pair<const char*, output_sink_t*>{"println_null", &null_sink},
+        {"println_fd", &fd_sink}, {"println_memory", &memory_sink}}) {
+      ret.push_back({name, [print, env, sink = sink](context_t& ctx) {
+        ctx.out = sink;
+        print->eval(env, ctx);
+        if (sink == &memory_sink) memory_sink.clear();
+      }, 0, 0});
+    }
+
+    auto list = std::make_shared<object_sptr_t>();
+    ret.push_back({"show", [list](context_t&) { (*list)->show(); }, 0, 0, [list](case_t&) {
+      std::string items;
+      for (size_t i = 0; i < 100000; i++) {
+        items += " (" + std::to_string(i) + " \"item\" " + std::to_string(i * 0.5) + ")";
+      }
+      *list = object_t::parse("(" + items + ")");
+    }});
+
+    static auto path = (std::filesystem::temp_directory_path() / "lisp_bench_lines.txt").string();
+    size_t lines = 100000;
+    auto lines_setup = [lines_fixture = fixture([lines] {
+      std::ofstream ofs(path);
+      for (size_t i = 0; i < lines; i++) {
+        ofs << i << ",2020-01-01T00:00:00,GET,/index.html," << i * 7 % 1000 << "\n";
+      }
+    })](case_t& c) {
+      lines_fixture();
+      c.bytes = std::filesystem::file_size(path);
+    };
+    ret.push_back({"lines_getline", [](context_t&) {
+      std::ifstream ifs(path);
+      size_t count = 0;
+      for (std::string line; std::getline(ifs, line); ) count++;
+    }, 0, lines, lines_setup});
+    ret.push_back({"lines_reader", [](context_t&) {
+      line_reader_t reader(path);
+      size_t count = 0;
+      for (std::string_view line; reader.next(line); ) count++;
+    }, 0, lines, lines_setup});
+    lisp("lines_fold", "(fold-lines (lambda (l acc) (+ acc 1)) 0 (open \"" + path + "\" \"r\"))", lines_setup);
+    ret.back().items = lines;
+    return ret;
+  }
+
+  // Live objects held by repetitive data loaded with and without hash-consing.
+  void memory_report(env_sptr_t env) {
+    auto path = (std::filesystem::temp_directory_path() / "lisp_bench_records.lisp").string();
+    {
+      std::ofstream ofs(path);
+      for (size_t i = 0; i < 20000; i++) {
+        ofs << "(\"GET\" \"/page/" << i % 16 << "\" " << (i % 7 ? 200 : 404) << " (\"host\" \"example.com\"))\n";
+      }
+    }
+    for (bool on : {false, true}) {
+      context_t ctx;
+      ctx.hash_consing = on;
+      auto expr = object_t::parse("(__kernel_load_data \"" + path + "\")");
+      auto live = runtime_stats.live();
+      auto data = expr->eval(env, ctx);
+      std::cout << "hash-consing " << (on ? "on: " : "off:") << std::setw(10) << runtime_stats.live() - live
+        << " live objects for 20000 records" << std::endl;
+    }
+  }
+
+  size_t resident_bytes() {
+    size_t size = 0, resident = 0;
+    std::ifstream("/proc/self/statm") >> size >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+  }
+
+  // Load of a generated library, eager and lazy. Each mode runs in a child
+  // process, so the numbers of one don't include the other's heap.
+  void lazy_report() {
+    auto path = (std::filesystem::temp_directory_path() / "lisp_bench_library.lispam").string();
+    {
+      std::ofstream ofs(path);
+      for (size_t i = 0; i < 5000; i++) {
+        ofs << "(def f-" << i << " (lambda (x) (if (less? x " << i << ") (* x 2) (+ x " << i << "))))\n";
+        ofs << "(def table-" << i << " (foldl (lambda (x acc) (cons (* x " << i << ") acc)) () (range 0 32)))\n";
+      }
+    }
+    std::cout.flush();
+    for (bool on : {false, true}) {
+      auto pid = fork();
+      if (pid < 0) throw std::runtime_error("bench: fork failed");
+      if (pid) {
+        waitpid(pid, nullptr, 0);
+        continue;
+      }
+      interpreter_t interpreter;
+      interpreter.set_lazy_defs(on);
+      interpreter.eval_file("standart.lispam");
+      auto heap = mallinfo2().uordblks;
+      auto live = runtime_stats.live();
+      auto start = std::chrono::steady_clock::now();
+      interpreter.eval("(load \"" + path + "\")");
+      auto load = std::chrono::steady_clock::now() - start;
+      interpreter.eval("(f-10 3) (f-20 30) (head table-30)");
+      std::cout << "lazy defs " << (on ? "on: " : "off:") << std::setw(10) << std::chrono::duration<double, std::milli>(load).count()
+        << " ms, " << std::setw(8) << (mallinfo2().uordblks - heap) / 1024 << " KB heap, " << std::setw(8)
+        << resident_bytes() / 1024 << " KB resident, " << std::setw(8) << runtime_stats.live() - live
+        << " live objects for 10000 defs" << std::endl;
+      _exit(0);
+    }
+  }
+
+  void save(const std::string& path, const std::vector<result_t>& results) {
+    std::ofstream ofs(path);
+    ofs << std::fixed << std::setprecision(1);
+    ofs << "{\"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+      const auto& r = results[i];
+      ofs << "  {\"name\": \"" << r.name << "\", \"ns_per_op\": " << r.ns_per_op
+        << ", \"eval_calls_per_op\": " << r.eval_calls_per_op
+        << ", \"allocs_per_op\": " << r.allocs_per_op << "}"
+        << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    ofs << "]}\n";
+  }
+
+  // The whole of 'text' is a number.
+  template <typename T>
+  bool parse_number(const std::string& text, T& value) {
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+    return !text.empty() && ec == std::errc() && end == text.data() + text.size();
+  }
+
+  // Reads files written by save(), one benchmark per line.
+  std::vector<result_t> load(const std::string& path) {
+    std::ifstream ifs(path);
+    if (!ifs) throw std::runtime_error("bench: can't read '" + path + "'");
+    std::vector<result_t> ret;
+    auto field = [](const std::string& line, const std::string& key) {
+      auto pos = line.find("\"" + key + "\": ");
+      return pos == std::string::npos ? std::string() : line.substr(pos + key.size() + 4);
+    };
+    for (std::string line; std::getline(ifs, line); ) {
+      auto name = field(line, "name");
+      if (name.empty()) continue;
+      ret.push_back({name.substr(1, name.find('"', 1) - 1), std::stod(field(line, "ns_per_op")),
+          std::stod(field(line, "eval_calls_per_op")), std::stod(field(line, "allocs_per_op"))});
+    }
+    return ret;
+  }
+
+  // Returns the number of benchmarks slower than baseline by more than threshold percent.
+  size_t compare(const std::vector<result_t>& baseline, const std::vector<result_t>& results, double threshold) {
+    size_t regressions = 0;
+    std::cout << std::left << std::setw(20) << "name" << std::right << std::setw(14) << "old ns/op"
+      << std::setw(14) << "new ns/op" << std::setw(10) << "change" << std::endl;
+    for (const auto& r : results) {
+      auto it = std::find_if(baseline.begin(), baseline.end(), [&r](auto& b) { return b.name == r.name; });
+      if (it == baseline.end()) continue;
+      double change = (r.ns_per_op / it->ns_per_op - 1) * 100;
+      bool regression = change > threshold;
+      regressions += regression;
+      std::cout << std::left << std::setw(20) << r.name << std::right << std::fixed << std::setprecision(1)
+        << std::setw(14) << it->ns_per_op << std::setw(14) << r.ns_per_op
+        << std::setw(9) << change << '%' << (regression ? "  REGRESSION" : "") << std::endl;
+    }
+    return regressions;
+  }
+
+}
+
+
+
+// lisp_bench [--filter STR] [--repeat N] [--json OUT] [--baseline OLD] [--threshold PCT]
+// lisp_bench --compare OLD NEW [--threshold PCT]
+int main(int argc, char** argv) {
+  std::vector<std::string> args(argv + 1, argv + argc);
+  std::string filter, json, baseline, compare_old, compare_new;
+  size_t repeats = 5;
+  double threshold = 10;
+
+  for (size_t i = 0; i < args.size(); i++) {
+    auto next = [&args, &i] { return i + 1 < args.size() ? args[++i] : std::string(); };
+    if (args[i] == "--filter") {
+      filter = next();
+    } else if (args[i] == "--repeat") {
+      if (!parse_number(next(), repeats) || !repeats) {
+        std::cerr << "bench: --repeat expects a positive integer" << std::endl;
+        return 2;
+      }
+    } else if (args[i] == "--json") {
+      json = next();
+    } else if (args[i] == "--baseline") {
+      baseline = next();
+    } else if (args[i] == "--threshold") {
+      if (!parse_number(next(), threshold)) {
+        std::cerr << "bench: --threshold expects a number" << std::endl;
+        return 2;
+      }
+    } else if (args[i] == "--compare") {
+      compare_old = next();
+      compare_new = next();
+    } else {
+      std::cerr << "bench: unknown argument '" << args[i] << "'" << std::endl;
+      return 2;
+    }
+  }
+
+  try {
+    if (!compare_old.empty()) {
+      return compare(load(compare_old), load(compare_new), threshold) ? 1 : 0;
+    }
+
+    std::vector<result_t> old;
+    if (!baseline.empty()) old = load(baseline); // before --json may overwrite it
+    // before the cases fill the heap
+    if (std::string("lazy_defs_load").find(filter) != std::string::npos) lazy_report();
+
+    interpreter_t interpreter("standart.lispam");
+    interpreter.register_function("add", [](int64_t x, int64_t y) { return x + y; });
+    auto env = interpreter.environment();
+
+    std::vector<result_t> results;
+    std::cout << std::left << std::setw(20) << "name" << std::right << std::setw(14) << "ns/op"
+      << std::setw(14) << "evals/op" << std::setw(14) << "allocs/op" << std::setw(10) << "MB/s" << std::setw(14) << "items/s" << std::endl;
+    for (auto& c : cases(env)) {
+      if (c.name.find(filter) == std::string::npos) continue;
+      if (c.setup) c.setup(c);
+      auto r = run(c, repeats);
+      results.push_back(r);
+      std::cout << std::left << std::setw(20) << r.name << std::right << std::fixed << std::setprecision(1)
+        << std::setw(14) << r.ns_per_op << std::setw(14) << r.eval_calls_per_op << std::setw(14) << r.allocs_per_op;
+      if (c.bytes) std::cout << std::setw(10) << c.bytes / r.ns_per_op * 1e9 / (1 << 20);
+      if (c.items) std::cout << std::setw(14) << std::setprecision(0) << c.items / r.ns_per_op * 1e9;
+      std::cout << std::endl;
+    }
+
+    if (std::string("memory_hashcons").find(filter) != std::string::npos) memory_report(env);
+
+    if (!json.empty()) save(json, results);
+    if (!baseline.empty()) return compare(old, results, threshold) ? 1 : 0;
+  } catch (const std::exception& e) {
+    std::cerr << "bench: " << e.what() << std::endl;
+    return 2;
+  }
+
+  return 0;
+}
+
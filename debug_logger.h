@@ -1,52 +1,162 @@
+#pragma once
 
-#include <cstdarg>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 
 
-#define DEBUG_LOGGER(name, indent)       debug_logger_t debug_logger(indent, name, __FILE__, __FUNCTION__, __LINE__)
-#define DEBUG_LOG(name, indent, ...)     debug_logger_t::log(name, indent, __LINE__, __VA_ARGS__)
+#define TRACE_SCOPE()                    trace_scope_t trace_scope(__FUNCTION__, __LINE__)
+#define TRACE_EVENT(name, ...)           if (!trace_t::enabled()) { } else trace_t::value(name, __LINE__, __VA_ARGS__)
 
-#define LOG_DURATION(time)               log_duration_t(time);
+#define LOG_DURATION(time)               log_duration_t log_duration(time);
 
 
 
-class debug_logger_t {
- public:
-  debug_logger_t(int& indent, const char* name, const char* file, const char* function, const int line)
-      : indent(indent), name(name), file(file), function(function), line(line) {
-    fprintf(stderr, "%s %d    %*s#%d --> %s\n", name, indent / 2, indent, "", line, function);
-    fflush(stderr);
-    indent += 2;
-    time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+// Fixed-size binary trace record. Strings are pointers to static storage,
+// they are resolved only when the trace is dumped.
+struct trace_record_t {
+  enum event_t : uint16_t { enter, exit, exit_exception, value };
+
+  uint64_t     time;    // ns, steady clock
+  const char*  name;    // function or label
+  const void*  object;
+  uint64_t     payload;
+  uint32_t     line;
+  uint16_t     event;
+  uint16_t     kind;    // user defined, no_kind for plain pointers
+
+  static constexpr uint16_t no_kind = 0xffff;
+};
+
+// Per-thread ring buffers of trace records. Each ring has a single writer,
+// the writer publishes records by a release store of the head. Only the
+// writer stores the head, clear() moves the start that dump() reads from. Tracing is
+// switched at runtime, the disabled cost is one relaxed load and a branch.
+struct trace_t {
+  static constexpr size_t    ring_size = 1 << 16;
+  static constexpr char      magic[8]  = "LTRACE1";
+
+  struct ring_t {
+    std::vector<trace_record_t>  records = std::vector<trace_record_t>(ring_size);
+    std::atomic<uint64_t>        head    = 0; // records written
+    std::atomic<uint64_t>        start   = 0; // records before it are cleared
+    uint64_t                     thread  = 0;
+  };
+
+  static bool enabled() {
+    return on.load(std::memory_order_relaxed);
+  }
+
+  static void enable(bool value) {
+    on.store(value, std::memory_order_relaxed);
+  }
+
+  static void record(uint16_t event, const char* name, uint32_t line,
+      const void* object = nullptr, uint16_t kind = trace_record_t::no_kind, uint64_t payload = 0) {
+    auto& r = ring();
+    auto head = r.head.load(std::memory_order_relaxed);
+    r.records[head & (ring_size - 1)] = {now(), name, object, payload, line, event, kind};
+    r.head.store(head + 1, std::memory_order_release);
+  }
+
+  static void value(const char* name, uint32_t line, const void* object,
+      uint16_t kind = trace_record_t::no_kind, uint64_t payload = 0) {
+    record(trace_record_t::value, name, line, object, kind, payload);
+  }
+
+  static void clear() {
+    std::lock_guard lock(mutex);
+    for (auto& ring : rings) {
+      ring->start.store(ring->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
   }
 
-  ~debug_logger_t( ) {
-    indent -= 2;
+  // Layout: magic, strings (id, size, bytes), rings (thread, count, records).
+  // Should be called while the traced threads are quiet.
+  static bool dump(const std::string& path) {
+    std::lock_guard lock(mutex);
+    std::unique_ptr<FILE, decltype(&fclose)> file(fopen(path.c_str(), "wb"), &fclose);
+    if (!file) return false;
+
+    std::vector<std::pair<const ring_t*, std::pair<uint64_t, uint64_t>>> ranges;
+    std::map<const char*, std::string> names;
+    for (const auto& ring : rings) {
+      uint64_t head = ring->head.load(std::memory_order_acquire);
+      uint64_t first = std::max(ring->start.load(std::memory_order_relaxed), head > ring_size ? head - ring_size : 0);
+      ranges.push_back({ring.get(), {first, head}});
+      for (auto i = first; i < head; i++) {
+        auto name = ring->records[i & (ring_size - 1)].name;
+        if (name) names.emplace(name, name);
+      }
+    }
+
+    auto write = [&file](const void* data, size_t size) { fwrite(data, 1, size, file.get()); };
+    auto write_u64 = [&write](uint64_t value) { write(&value, sizeof(value)); };
+
+    write(magic, sizeof(magic));
+    write_u64(names.size());
+    for (const auto& kv : names) {
+      write_u64(reinterpret_cast<uint64_t>(kv.first));
+      write_u64(kv.second.size());
+      write(kv.second.data(), kv.second.size());
+    }
+    write_u64(ranges.size());
+    for (const auto& [ring, range] : ranges) {
+      write_u64(ring->thread);
+      write_u64(range.second - range.first);
+      for (auto i = range.first; i < range.second; i++) {
+        write(&ring->records[i & (ring_size - 1)], sizeof(trace_record_t));
+      }
+    }
+    return !ferror(file.get());
+  }
 
-    time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count() - time;
-    fprintf(stderr, "%s %d %c  %*s# <-- %s %ldms\n", name, indent / 2, std::uncaught_exceptions() ? '*' : ' ', indent, "", function, time);
-    fflush(stderr);
+ private:
+  static ring_t& ring() {
+    thread_local ring_t* ring = attach();
+    return *ring;
   }
 
-  static void log(const char* name, int indent, int line, const char* format, ...) {
-    fprintf(stderr, "%s %d    %*s#%d    ", name, indent / 2, indent, "", line);
+  static ring_t* attach() {
+    auto ring = std::make_shared<ring_t>();
+    ring->thread = std::hash<std::thread::id>()(std::this_thread::get_id());
+    std::lock_guard lock(mutex);
+    rings.push_back(ring); // kept after thread exit for dump
+    return ring.get();
+  }
 
-    va_list args;
-    va_start(args, format);
-    vfprintf(stderr, format, args);
-    va_end(args);
-    fprintf(stderr, "\n");
-    fflush(stderr);
+  static uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  static inline std::atomic<bool>                    on = false;
+  static inline std::mutex                           mutex;
+  static inline std::vector<std::shared_ptr<ring_t>> rings;
+};
+
+struct trace_scope_t {
+  trace_scope_t(const char* name, uint32_t line) : name(name), active(trace_t::enabled()) {
+    if (active) trace_t::record(trace_record_t::enter, name, line);
+  }
+
+  ~trace_scope_t() {
+    if (active) trace_t::record(std::uncaught_exceptions() ? trace_record_t::exit_exception : trace_record_t::exit, name, 0);
   }
 
  private:
-  int&         indent;
-  const  char* name;
-  const  char* file; // TODO
-  const  char* function;
-  const  int   line;
-  uint64_t     time;
+  const char* name;
+  bool        active;
 };
 
 struct log_duration_t {
@@ -56,10 +166,11 @@ struct log_duration_t {
   ~log_duration_t() {
     auto finish = std::chrono::steady_clock::now();
     auto dur = finish - start;
-    time = std::chrono::duration_cast<std::chrono::milliseconds>(dur).count();
+    time = std::chrono::duration_cast<std::chrono::nanoseconds>(dur).count();
   }
 
  private:
   uint64_t& time;
   std::chrono::steady_clock::time_point start;
 };
+
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mapped_file.h"
+#include "output_sink.h"
+
+
+
+// Sequential line reader over a mapped file. Lines are views into the
+// mapping, valid while the reader or a copy of mapping() lives. Pages behind
+// the cursor are released in steps, so resident memory does not grow with
+// the file; they are read from the file again if a line is used later.
+struct line_reader_t {
+  static constexpr size_t release_step = 16 << 20;
+
+  line_reader_t(const std::string& path) : file(std::make_shared<mapped_file_t>(path)), offset(0), released(0) {
+  }
+
+  bool is_open() const {
+    return file->is_open();
+  }
+
+  std::shared_ptr<const mapped_file_t> mapping() const {
+    return file;
+  }
+
+  // Next line without the line break, false at the end of file.
+  bool next(std::string_view& line) {
+    auto data = file->view();
+    if (offset >= data.size()) return false;
+
+    auto begin = data.data() + offset;
+    auto end = static_cast<const char*>(std::memchr(begin, '\n', data.size() - offset));
+    size_t size = end ? end - begin : data.size() - offset;
+    offset += size + (end ? 1 : 0);
+    if (size && begin[size - 1] == '\r') size--;
+    line = {begin, size};
+
+    if (offset - released >= release_step) {
+      released = offset;
+      file->release(released);
+    }
+    return true;
+  }
+
+ private:
+  std::shared_ptr<mapped_file_t> file;
+  size_t                         offset;
+  size_t                         released;
+};
+
+// Buffered writer that owns its descriptor.
+struct file_writer_t : fd_sink_t {
+  file_writer_t(int fd) : fd_sink_t(fd), fd(fd) {
+  }
+
+  ~file_writer_t() {
+    close();
+  }
+
+  static int open(const std::string& path, bool append) {
+    return ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0644);
+  }
+
+  void close() {
+    if (fd < 0) return;
+    flush();
+    ::close(fd);
+    fd = -1;
+  }
+
+  bool is_open() const {
+    return fd >= 0;
+  }
+
+  using fd_sink_t::write;
+
+ private:
+  int fd;
+};
+
@@ -0,0 +1,274 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+
+
+// Persistent hash array mapped trie. Nodes hold entries and children in two
+// bitmap-indexed arrays, updates copy the path to the changed entry and share
+// everything else. Keys with equal 64-bit hashes end in a collision node.
+template <typename K, typename V, typename Hash, typename Equal>
+struct hamt_t {
+  static constexpr size_t bits      = 5;
+  static constexpr size_t max_shift = 64; // nodes at this shift are collision lists
+
+  struct entry_t {
+    K key;
+    V value;
+  };
+
+  struct node_t;
+  using node_sptr_t = std::shared_ptr<node_t>;
+
+  struct node_t {
+    uint32_t                  datamap = 0;
+    uint32_t                  nodemap = 0;
+    std::vector<entry_t>      entries; // in bit order, unordered in collision nodes
+    std::vector<node_sptr_t>  nodes;
+    uint64_t                  edit    = 0; // transient allowed to change the node in place
+  };
+
+  // Batch builder. Nodes made by one transient are changed in place by it,
+  // shared nodes are copied first, so the source map is never changed.
+  struct transient_t {
+    transient_t(const hamt_t& from = {}) : root(from.root), count(from.count), edit(next_edit()) {
+    }
+
+    void assoc(const K& key, const V& value) {
+      bool added = false;
+      root = insert(root, 0, Hash()(key), key, value, added, edit);
+      count += added;
+    }
+
+    void dissoc(const K& key) {
+      bool removed = false;
+      root = erase(root, 0, Hash()(key), key, removed, edit);
+      count -= removed;
+    }
+
+    // Later changes through this transient copy nodes again.
+    hamt_t persistent() {
+      edit = next_edit();
+      hamt_t ret;
+      ret.root = root;
+      ret.count = count;
+      return ret;
+    }
+
+   private:
+    node_sptr_t root;
+    size_t      count;
+    uint64_t    edit;
+  };
+
+  size_t size() const {
+    return count;
+  }
+
+  const V* find(const K& key) const {
+    size_t hash = Hash()(key);
+    const node_t* node = root.get();
+    for (size_t shift = 0; node; shift += bits) {
+      if (shift >= max_shift) {
+        for (const auto& entry : node->entries) {
+          if (Equal()(entry.key, key)) return &entry.value;
+        }
+        return nullptr;
+      }
+      uint32_t bit = 1u << ((hash >> shift) & 31);
+      if (node->datamap & bit) {
+        const auto& entry = node->entries[index(node->datamap, bit)];
+        return Equal()(entry.key, key) ? &entry.value : nullptr;
+      }
+      if (!(node->nodemap & bit)) return nullptr;
+      node = node->nodes[index(node->nodemap, bit)].get();
+    }
+    return nullptr;
+  }
+
+  hamt_t assoc(const K& key, const V& value) const {
+    hamt_t ret = *this;
+    bool added = false;
+    ret.root = insert(root, 0, Hash()(key), key, value, added, 0);
+    ret.count += added;
+    return ret;
+  }
+
+  hamt_t dissoc(const K& key) const {
+    hamt_t ret = *this;
+    bool removed = false;
+    ret.root = erase(root, 0, Hash()(key), key, removed, 0);
+    ret.count -= removed;
+    return ret;
+  }
+
+  // f(key, value) for every entry, in hash order.
+  template <typename F>
+  void for_each(F f) const {
+    std::vector<const node_t*> stack;
+    if (root) stack.push_back(root.get());
+    while (!stack.empty()) {
+      auto node = stack.back();
+      stack.pop_back();
+      for (const auto& entry : node->entries) {
+        f(entry.key, entry.value);
+      }
+      for (auto it = node->nodes.rbegin(); it != node->nodes.rend(); ++it) {
+        stack.push_back(it->get());
+      }
+    }
+  }
+
+ private:
+  static size_t index(uint32_t bitmap, uint32_t bit) {
+    return std::popcount(bitmap & (bit - 1));
+  }
+
+  static uint64_t next_edit() {
+    static std::atomic<uint64_t> edit = 0;
+    return edit.fetch_add(1, std::memory_order_relaxed) + 1;
+  }
+
+  static node_sptr_t editable(const node_sptr_t& node, uint64_t edit) {
+    if (edit && node->edit == edit) return node;
+    auto ret = std::make_shared<node_t>(*node);
+    ret->edit = edit;
+    return ret;
+  }
+
+  // Node with two entries whose hashes agree below 'shift'.
+  static node_sptr_t merge(entry_t x, size_t hx, entry_t y, size_t hy, size_t shift, uint64_t edit) {
+    auto node = std::make_shared<node_t>();
+    node->edit = edit;
+    if (shift >= max_shift) {
+      node->entries = {std::move(x), std::move(y)};
+      return node;
+    }
+    uint32_t bx = (hx >> shift) & 31;
+    uint32_t by = (hy >> shift) & 31;
+    if (bx == by) {
+      node->nodemap = 1u << bx;
+      node->nodes.push_back(merge(std::move(x), hx, std::move(y), hy, shift + bits, edit));
+    } else {
+      node->datamap = (1u << bx) | (1u << by);
+      if (bx < by) {
+        node->entries = {std::move(x), std::move(y)};
+      } else {
+        node->entries = {std::move(y), std::move(x)};
+      }
+    }
+    return node;
+  }
+
+  static node_sptr_t insert(const node_sptr_t& from, size_t shift, size_t hash,
+      const K& key, const V& value, bool& added, uint64_t edit) {
+    auto node = from ? from : std::make_shared<node_t>();
+
+    if (shift >= max_shift) {
+      for (size_t i = 0; i < node->entries.size(); i++) {
+        if (!Equal()(node->entries[i].key, key)) continue;
+        auto ret = editable(node, edit);
+        ret->entries[i].value = value;
+        return ret;
+      }
+      auto ret = editable(node, edit);
+      ret->entries.push_back({key, value});
+      added = true;
+      return ret;
+    }
+
+    uint32_t bit = 1u << ((hash >> shift) & 31);
+    if (node->datamap & bit) {
+      size_t i = index(node->datamap, bit);
+      const auto& entry = node->entries[i];
+      auto ret = editable(node, edit);
+      if (Equal()(entry.key, key)) {
+        ret->entries[i].value = value;
+        return ret;
+      }
+      auto child = merge(entry, Hash()(entry.key), {key, value}, hash, shift + bits, edit);
+      ret->entries.erase(ret->entries.begin() + i);
+      ret->datamap ^= bit;
+      ret->nodemap |= bit;
+      ret->nodes.insert(ret->nodes.begin() + index(ret->nodemap, bit), child);
+      added = true;
+      return ret;
+    }
+
+    if (node->nodemap & bit) {
+      size_t i = index(node->nodemap, bit);
+      auto child = insert(node->nodes[i], shift + bits, hash, key, value, added, edit);
+      if (child == node->nodes[i]) return node;
+      auto ret = editable(node, edit);
+      ret->nodes[i] = child;
+      return ret;
+    }
+
+    auto ret = editable(node, edit);
+    ret->datamap |= bit;
+    ret->entries.insert(ret->entries.begin() + index(ret->datamap, bit), {key, value});
+    added = true;
+    return ret;
+  }
+
+  // Returns nullptr for an empty node. A child left with a single entry is
+  // pulled up, so equal maps have the same shape.
+  static node_sptr_t erase(const node_sptr_t& node, size_t shift, size_t hash,
+      const K& key, bool& removed, uint64_t edit) {
+    if (!node) return node;
+
+    if (shift >= max_shift) {
+      for (size_t i = 0; i < node->entries.size(); i++) {
+        if (!Equal()(node->entries[i].key, key)) continue;
+        removed = true;
+        if (node->entries.size() == 1) return nullptr;
+        auto ret = editable(node, edit);
+        ret->entries.erase(ret->entries.begin() + i);
+        return ret;
+      }
+      return node;
+    }
+
+    uint32_t bit = 1u << ((hash >> shift) & 31);
+    if (node->datamap & bit) {
+      size_t i = index(node->datamap, bit);
+      if (!Equal()(node->entries[i].key, key)) return node;
+      removed = true;
+      if (node->entries.size() == 1 && node->nodes.empty()) return nullptr;
+      auto ret = editable(node, edit);
+      ret->entries.erase(ret->entries.begin() + i);
+      ret->datamap ^= bit;
+      return ret;
+    }
+
+    if (node->nodemap & bit) {
+      size_t i = index(node->nodemap, bit);
+      auto child = erase(node->nodes[i], shift + bits, hash, key, removed, edit);
+      if (!removed) return node;
+      auto ret = editable(node, edit);
+      if (!child) {
+        ret->nodes.erase(ret->nodes.begin() + i);
+        ret->nodemap ^= bit;
+      } else if (child->nodes.empty() && child->entries.size() == 1) {
+        ret->nodes.erase(ret->nodes.begin() + i);
+        ret->nodemap ^= bit;
+        ret->datamap |= bit;
+        ret->entries.insert(ret->entries.begin() + index(ret->datamap, bit), child->entries.front());
+      } else {
+        ret->nodes[i] = child;
+      }
+      if (ret->entries.empty() && ret->nodes.empty()) return nullptr;
+      return ret;
+    }
+
+    return node;
+  }
+
+  node_sptr_t root;
+  size_t      count = 0;
+};
+
@@ -3,6 +3,247 @@
 
 namespace lisp_interpreter {
 
+  void metrics_t::merge(const metrics_t& other) {
+    eval_calls += other.eval_calls;
+    time_parse += other.time_parse;
+    time_eval += other.time_eval;
+    stack_level_max = std::max(stack_level_max, other.stack_level_max);
+    env_frames += other.env_frames;
+    macro_expansions += other.macro_expansions;
+  }
+
+  void metrics_t::show_json(std::ostream& os) const {
+    os << "{\"eval_calls\": " << eval_calls
+      << ", \"time_parse_ns\": " << time_parse
+      << ", \"time_eval_ns\": " << time_eval
+      << ", \"stack_level_max\": " << stack_level_max
+      << ", \"env_frames\": " << env_frames
+      << ", \"macro_expansions\": " << macro_expansions
+      << ", \"exceptions\": " << runtime_stats.exceptions()
+      << ", \"bytes_allocated\": " << runtime_stats.bytes()
+      << ", \"objects_live\": " << runtime_stats.live()
+      << ", \"objects_live_peak\": " << runtime_stats.live_peak()
+      << ", \"allocations\": {";
+    for (size_t i = 0; i < std::variant_size_v<object_t::variant_t>; i++) {
+      os << (i ? ", " : "") << '"' << object_t::type_name(i) << "\": " << runtime_stats.allocations(i);
+    }
+    os << "}}";
+  }
+
+  void metrics_t::show_prometheus(std::ostream& os) const {
+    auto metric = [&os](const char* name, const char* type, auto value) {
+      os << "# TYPE lisp_" << name << ' ' << type << "\nlisp_" << name << ' ' << value << '\n';
+    };
+    metric("eval_calls_total", "counter", eval_calls);
+    metric("time_parse_ns_total", "counter", time_parse);
+    metric("time_eval_ns_total", "counter", time_eval);
+    metric("stack_level_max", "gauge", stack_level_max);
+    metric("env_frames_total", "counter", env_frames);
+    metric("macro_expansions_total", "counter", macro_expansions);
+    metric("exceptions_total", "counter", runtime_stats.exceptions());
+    metric("allocated_bytes_total", "counter", runtime_stats.bytes());
+    metric("objects_live", "gauge", runtime_stats.live());
+    metric("objects_live_peak", "gauge", runtime_stats.live_peak());
+    os << "# TYPE lisp_allocations_total counter\n";
+    for (size_t i = 0; i < std::variant_size_v<object_t::variant_t>; i++) {
+      os << "lisp_allocations_total{kind=\"" << object_t::type_name(i) << "\"} " << runtime_stats.allocations(i) << '\n';
+    }
+  }
+
+  void trace_object(const char* name, uint32_t line, const object_t* object) {
+    uint64_t payload = 0;
+    std::visit(overloaded {
+      [&payload] (bool v)    { payload = v; },
+      [&payload] (int64_t v) { payload = v; },
+      [&payload] (double v)  { payload = std::bit_cast<uint64_t>(v); },
+      [] (auto) { },
+    }, object->value);
+    trace_t::value(name, line, object, object->value.index(), payload);
+  }
+
+  object_t::~object_t() {
+    DEBUG_LOGGER_TRACE_LISP;
+    DEBUG_LOGGER_LISP("this", this);
+    runtime_stats.on_free();
+    if (is_interned()) unintern(this);
+
+    // Long lists and deep nesting are released in a loop, recursive destruction overflows the stack.
+    // Most cells have one child to release, it is kept in 'next' without allocating.
+    object_sptr_t next;
+    std::vector<object_sptr_t> more;
+    unlink(*this, next, more);
+    while (next || !more.empty()) {
+      auto object = std::move(next);
+      if (!object) {
+        object = std::move(more.back());
+        more.pop_back();
+      }
+      unlink(*object, next, more);
+    }
+  }
+
+  void object_t::unlink(const object_t& object, object_sptr_t& next, std::vector<object_sptr_t>& more) {
+    auto take = [&next, &more](object_sptr_t& child) {
+      if (!child || (!child->as_list() && !child->as_seq())) return;
+      if (child->is_interned()) {
+        // Checked and dropped from the table under its lock, a lookup can't revive it afterwards.
+        std::lock_guard lock(intern_mutex());
+        if (child.use_count() != 1) return;
+        unintern_locked(child.get());
+        const_cast<object_list_t&>(**child->as_list()).interned = false;
+      } else if (child.use_count() != 1) {
+        return;
+      }
+      if (next) {
+        more.push_back(std::move(child));
+      } else {
+        next = std::move(child);
+      }
+    };
+    if (auto seq = object.as_seq(); seq && *seq && seq->use_count() == 1) {
+      take((*seq)->first);
+      take((*seq)->rest);
+      return;
+    }
+    auto list = object.as_list();
+    if (!list || !*list || list->use_count() != 1) return;
+    auto& cell = const_cast<object_list_t&>(**list);
+    take(cell.head);
+    take(cell.tail);
+  }
+
+  size_t object_t::payload_size(const variant_t& value) {
+    size_t size = 0;
+    std::visit(overloaded {
+      [&size] (object_string_sptr_t v) { size = sizeof(*v) + v->own_bytes(); },
+      [&size] (object_ident_sptr_t v)  { size = sizeof(*v) + v->value.capacity(); },
+      [&size] (object_list_sptr_t v)   { size = sizeof(*v); },
+      [&size] (object_lambda_sptr_t v) { size = sizeof(*v); },
+      [&size] (object_macro_sptr_t v)  { size = sizeof(*v); },
+      [&size] (object_file_sptr_t v)   { size = sizeof(*v) + v->path.capacity(); },
+      [&size] (object_seq_sptr_t v)    { size = sizeof(*v); },
+      [&size] (object_native_sptr_t v) { size = sizeof(*v) + v->name.capacity(); },
+      [&size] (object_map_sptr_t v)    { size = sizeof(*v); },
+      [&size] (object_vec_sptr_t v)    { size = sizeof(*v) + v->size() * 8; },
+      [&size] (object_thunk_sptr_t v)  { size = sizeof(*v) + v->name.capacity(); },
+      [] (auto) { },
+    }, value);
+    return size;
+  }
+
+  const char* object_t::type_name(size_t index) {
+    static const char* names[] = { "nil", "bool", "int", "double", "string", "ident", "list", "lambda", "macro", "file", "seq", "native", "map", "vec", "thunk" };
+    static_assert(std::size(names) == std::variant_size_v<variant_t>);
+    return names[index];
+  }
+
+  object_t::object_string_t::object_string_t(std::string value)
+      : length(value.size()), owned(value.capacity()) {
+    buf = own(std::move(value));
+  }
+
+  object_t::object_string_t::object_string_t(buffer_t buffer, size_t offset, size_t size)
+      : buf(std::move(buffer)), offset(offset), length(size) {
+  }
+
+  object_t::object_string_t::object_string_t(object_string_sptr_t left, object_string_sptr_t right)
+      : length(left->size() + right->size()), left(std::move(left)), right(std::move(right)) {
+  }
+
+  object_t::object_string_t::~object_string_t() {
+    // Strings built by appending in a loop are deep, unlinked in a loop as lists are.
+    std::vector<object_string_sptr_t> parts;
+    auto take = [&parts] (object_string_sptr_t& part) {
+      if (part && part.use_count() == 1) parts.push_back(std::move(part));
+    };
+    take(left);
+    take(right);
+    while (!parts.empty()) {
+      auto part = std::move(parts.back());
+      parts.pop_back();
+      auto& str = const_cast<object_string_t&>(*part);
+      take(str.left);
+      take(str.right);
+    }
+  }
+
+  object_t::object_string_t::buffer_t object_t::object_string_t::own(std::string str) {
+    auto holder = std::make_shared<const std::string>(std::move(str));
+    return buffer_t(holder, holder->data());
+  }
+
+  std::string_view object_t::object_string_t::flat() const {
+    if (left) {
+      std::string str;
+      str.reserve(length);
+      for_each_chunk([&str] (std::string_view chunk) { str.append(chunk); });
+      buf = own(std::move(str));
+      left.reset();
+      right.reset();
+    }
+    return {buf.get() + offset, length};
+  }
+
+  std::pair<object_t::object_string_t::buffer_t, size_t> object_t::object_string_t::buffer() const {
+    flat();
+    return {buf, offset};
+  }
+
+  int object_t::object_string_t::compare(const object_string_t& other) const {
+    if (is_flat() && other.is_flat()) return view().compare(other.view());
+    if (other.is_flat()) {
+      int ret = other.compare(*this);
+      return ret < 0 ? 1 : ret > 0 ? -1 : 0;
+    }
+
+    // The parts of 'other' are matched against this string, or against the
+    // parts of this rope when both are ropes. Nothing is copied.
+    std::vector<std::string_view> xs;
+    std::string_view x;
+    if (is_flat()) {
+      x = view();
+    } else {
+      for_each_chunk([&xs] (std::string_view chunk) { if (!chunk.empty()) xs.push_back(chunk); });
+    }
+    size_t i = 0;
+    int ret = 0;
+    other.for_each_chunk([&xs, &x, &i, &ret] (std::string_view y) {
+      while (!y.empty()) {
+        if (x.empty() && i < xs.size()) x = xs[i++];
+        if (x.empty()) {
+          ret = -1;
+          return false;
+        }
+        size_t n = std::min(x.size(), y.size());
+        if ((ret = x.substr(0, n).compare(y.substr(0, n)))) return false;
+        x.remove_prefix(n);
+        y.remove_prefix(n);
+      }
+      return true;
+    });
+    if (ret) return ret;
+    return x.empty() && i == xs.size() ? 0 : 1;
+  }
+
+  object_sptr_t object_t::string_concat(const object_string_sptr_t& x, const object_string_sptr_t& y, const context_t& ctx) {
+    if (ctx.hash_consing || x->size() + y->size() <= object_string_t::flat_max) {
+      std::string str;
+      str.reserve(x->size() + y->size());
+      x->for_each_chunk([&str] (std::string_view chunk) { str.append(chunk); });
+      y->for_each_chunk([&str] (std::string_view chunk) { str.append(chunk); });
+      return string(std::move(str), ctx);
+    }
+    auto l = std::make_shared<object_string_t>(x, y);
+    return std::make_shared<object_t>(object_string_sptr_t(l));
+  }
+
+  object_sptr_t object_t::string_slice(const object_string_sptr_t& str, size_t from, size_t to, const context_t& ctx) {
+    if (ctx.hash_consing) return intern_string(std::string(str->flat().substr(from, to - from)));
+    auto [buffer, offset] = str->buffer();
+    auto l = std::make_shared<object_string_t>(std::move(buffer), offset + from, to - from);
+    return std::make_shared<object_t>(object_string_sptr_t(l));
+  }
+
   object_sptr_t object_t::reverse(bool recursive) const {
     auto obj = self();
     if (!obj->as_list()) return obj;
@@ -15,13 +256,282 @@ namespace lisp_interpreter {
     return ret;
   }
 
+  namespace {
+
+    size_t hash_mix(size_t seed, size_t value) {
+      return seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+    }
+
+    size_t hash_nonzero(size_t hash) {
+      return hash ? hash : 1;
+    }
+
+    size_t hash_cell(size_t head, size_t tail) {
+      return hash_nonzero(hash_mix(hash_mix(0x6c697374, head), tail));
+    }
+
+    // Weak table of hash-consed objects by structural hash. The raw pointer
+    // identifies the entry when the object is destroyed.
+    using intern_table_t = std::unordered_multimap<size_t, std::pair<const object_t*, std::weak_ptr<const object_t>>>;
+
+    intern_table_t& intern_table() {
+      static intern_table_t table;
+      return table;
+    }
+
+  }
+
+  size_t object_t::hash() const {
+    auto hash_string = [](size_t index, std::string_view str) {
+      return hash_nonzero(hash_mix(index, std::hash<std::string_view>()(str)));
+    };
+
+    if (auto str = as_string()) {
+      auto ret = (*str)->hash.load(std::memory_order_relaxed);
+      if (!ret) {
+        ret = hash_string(value.index(), (*str)->flat());
+        (*str)->hash.store(ret, std::memory_order_relaxed);
+      }
+      return ret;
+    }
+
+    if (auto map = as_map()) {
+      // Summed over the entries, so equal maps built in any order hash the same.
+      size_t ret = 0;
+      (*map)->map.for_each([&ret](const object_sptr_t& key, const object_sptr_t& value) {
+        ret += hash_cell(key->hash(), value->hash());
+      });
+      return hash_nonzero(hash_mix(value.index(), ret));
+    }
+
+    if (auto list = as_list()) {
+      // Cells without a cached hash are hashed after their head and tail, the
+      // explicit stack keeps long lists and deep nesting off the call stack.
+      auto cached = [](const object_t* object) {
+        auto list = object->as_list();
+        return list ? (*list)->hash.load(std::memory_order_relaxed) : object->hash();
+      };
+      std::vector<std::pair<const object_list_t*, bool>> stack{{list->get(), false}};
+      while (!stack.empty()) {
+        auto [cell, expanded] = stack.back();
+        if (cell->hash.load(std::memory_order_relaxed)) {
+          stack.pop_back();
+        } else if (!expanded) {
+          stack.back().second = true;
+          for (auto child : {cell->tail.get(), cell->head.get()}) {
+            auto l = child->as_list();
+            if (l && !(*l)->hash.load(std::memory_order_relaxed)) stack.push_back({l->get(), false});
+          }
+        } else {
+          stack.pop_back();
+          cell->hash.store(hash_cell(cached(cell->head.get()), cached(cell->tail.get())), std::memory_order_relaxed);
+        }
+      }
+      return (*list)->hash.load(std::memory_order_relaxed);
+    }
+
+    size_t ret = 0;
+    std::visit(overloaded {
+      [&ret] (bool v)                       { ret = std::hash<bool>()(v); },
+      [&ret] (int64_t v)                    { ret = std::hash<int64_t>()(v); },
+      [&ret] (double v)                     { ret = std::hash<double>()(v); },
+      [&ret] (const object_nil_sptr_t&)     { ret = 0; },
+      [&ret, &hash_string, this] (const object_ident_sptr_t& v) { ret = hash_string(value.index(), v->value); },
+      [&ret] (const auto& v)                { ret = std::hash<const void*>()(v.get()); },
+    }, value);
+    return hash_nonzero(hash_mix(value.index(), ret));
+  }
+
+  namespace {
+
+    // Atoms by type and value, strings by value, other objects by identity.
+    bool same_atom(const object_t::variant_t& x, const object_t::variant_t& y) {
+      if (x.index() != y.index()) return false;
+      if (auto a = std::get_if<bool>(&x)) return *a == std::get<bool>(y);
+      if (auto a = std::get_if<int64_t>(&x)) return *a == std::get<int64_t>(y);
+      if (auto a = std::get_if<double>(&x)) return *a == std::get<double>(y);
+      if (std::get_if<object_t::object_nil_sptr_t>(&x)) return true;
+      if (auto a = std::get_if<object_t::object_string_sptr_t>(&x)) return (*a)->equals(*std::get<object_t::object_string_sptr_t>(y));
+      if (auto a = std::get_if<object_t::object_ident_sptr_t>(&x)) return (*a)->value == std::get<object_t::object_ident_sptr_t>(y)->value;
+      bool ret = false;
+      std::visit([&ret, &y] (const auto& a) {
+        if constexpr (!std::is_arithmetic_v<std::decay_t<decltype(a)>>) {
+          ret = a == std::get<std::decay_t<decltype(a)>>(y);
+        }
+      }, x);
+      return ret;
+    }
+
+    // Like list elements, the numbers of both vecs are of the same type.
+    bool same_vec(const object_t::object_vec_t& x, const object_t::object_vec_t& y) {
+      if (x.values.index() != y.values.index() || x.size() != y.size()) return false;
+      return std::visit([&y] (const auto& a) {
+        const auto& b = std::get<std::decay_t<decltype(a)>>(y.values);
+        return std::equal(a.data(), a.data() + a.size(), b.data());
+      }, x.values);
+    }
+
+  }
+
+  bool object_t::equal(const object_sptr_t& x, const object_sptr_t& y) {
+    std::vector<std::pair<const object_t*, const object_t*>> stack{{x.get(), y.get()}};
+    while (!stack.empty()) {
+      auto [a, b] = stack.back();
+      stack.pop_back();
+      if (a == b) continue;
+
+      auto la = a->as_list();
+      auto lb = b->as_list();
+      if (la && lb) {
+        if ((*la)->interned && (*lb)->interned) return false;
+        auto ha = (*la)->hash.load(std::memory_order_relaxed);
+        auto hb = (*lb)->hash.load(std::memory_order_relaxed);
+        if (ha && hb && ha != hb) return false;
+        stack.push_back({(*la)->tail.get(), (*lb)->tail.get()});
+        stack.push_back({(*la)->head.get(), (*lb)->head.get()});
+        continue;
+      }
+
+      auto ma = a->as_map();
+      auto mb = b->as_map();
+      if (ma && mb) {
+        if ((*ma)->map.size() != (*mb)->map.size()) return false;
+        bool found = true;
+        (*ma)->map.for_each([&found, &stack, mb](const object_sptr_t& key, const object_sptr_t& value) {
+          auto other = (*mb)->map.find(key);
+          if (other) {
+            stack.push_back({value.get(), other->get()});
+          } else {
+            found = false;
+          }
+        });
+        if (!found) return false;
+        continue;
+      }
+
+      auto va = a->as_vec();
+      auto vb = b->as_vec();
+      if (va && vb) {
+        if (!same_vec(**va, **vb)) return false;
+        continue;
+      }
+
+      if (a->is_interned() && b->is_interned()) return false;
+      if (!same_atom(a->value, b->value)) return false;
+    }
+    return true;
+  }
+
+  std::mutex& object_t::intern_mutex() {
+    static std::mutex mutex;
+    return mutex;
+  }
+
+  object_sptr_t object_t::intern_string(std::string str) {
+    auto l = std::make_shared<object_string_t>(std::move(str));
+    auto object = std::make_shared<object_t>(l);
+    auto hash = object->hash();
+
+    std::vector<object_sptr_t> seen; // released after the lock, may run ~object_t
+    std::lock_guard lock(intern_mutex());
+    auto& table = intern_table();
+    auto [first, last] = table.equal_range(hash);
+    for (auto it = first; it != last; ++it) {
+      auto other = it->second.second.lock();
+      if (!other) continue;
+      seen.push_back(other);
+      auto s = other->as_string();
+      if (s && (*s)->equals(*l)) return other;
+    }
+    l->interned = true;
+    table.emplace(hash, std::make_pair(object.get(), object));
+    return object;
+  }
+
+  object_sptr_t object_t::intern_list(object_sptr_t head, object_sptr_t tail) {
+    // Maps and vecs are equal by contents and seqs may be realized into lists,
+    // so cells holding them are left plain, like cells of uninterned lists.
+    bool canonical = head->is_interned()
+      || !(head->as_list() || head->as_string() || head->as_map() || head->as_vec() || head->as_seq());
+    if (!canonical || !(tail->as_nil() || tail->is_interned())) {
+      auto l = std::make_shared<object_list_t>(head, tail);
+      return std::make_shared<object_t>(l);
+    }
+    auto hash = hash_cell(head->hash(), tail->hash());
+
+    std::vector<object_sptr_t> seen; // released after the lock, may run ~object_t
+    std::lock_guard lock(intern_mutex());
+    auto& table = intern_table();
+    auto [first, last] = table.equal_range(hash);
+    for (auto it = first; it != last; ++it) {
+      auto other = it->second.second.lock();
+      if (!other) continue;
+      seen.push_back(other);
+      auto l = other->as_list();
+      if (l && (*l)->tail == tail && ((*l)->head == head || same_atom((*l)->head->value, head->value))) return other;
+    }
+    auto l = std::make_shared<object_list_t>(head, tail);
+    l->hash = hash;
+    l->interned = true;
+    auto object = std::make_shared<object_t>(object_list_sptr_t(l));
+    table.emplace(hash, std::make_pair(object.get(), object));
+    return object;
+  }
+
+  object_sptr_t object_t::intern(object_sptr_t object) {
+    if (auto str = object->as_string()) return (*str)->interned ? object : intern_string(std::string((*str)->flat()));
+    if (!object->as_list() || object->is_interned()) return object;
+
+    std::vector<object_sptr_t> heads;
+    auto tail = object;
+    while (auto list = tail->as_list()) {
+      if ((*list)->interned) break;
+      heads.push_back(intern((*list)->head));
+      tail = (*list)->tail;
+    }
+    for (auto it = heads.rbegin(); it != heads.rend(); ++it) {
+      tail = intern_list(*it, tail);
+    }
+    return tail;
+  }
+
+  void object_t::unintern(const object_t* object) {
+    std::lock_guard lock(intern_mutex());
+    unintern_locked(object);
+  }
+
+  void object_t::unintern_locked(const object_t* object) {
+    auto hash = object->as_list() ? (*object->as_list())->hash.load() : (*object->as_string())->hash.load();
+    auto& table = intern_table();
+    auto [first, last] = table.equal_range(hash);
+    for (auto it = first; it != last; ++it) {
+      if (it->second.first == object) {
+        table.erase(it);
+        return;
+      }
+    }
+  }
+
+  source_loc_t object_t::location(object_sptr_t args, object_sptr_t body) {
+    for (const auto& object : {body, args}) {
+      if (auto list = object->as_list()) return (*list)->loc;
+    }
+    return {};
+  }
+
+  template <typename T>
+  std::string object_t::profile_name(const T& function, const char* kind) {
+    auto loc = location(function->args, function->body);
+    return (function->name.empty() ? std::string(kind) : function->name) + "@" + (loc.line ? loc.show() : "?");
+  }
+
   object_sptr_t object_t::eval_plus(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
     DEBUG_LOGGER_TRACE_LISP;
     auto p = t->decompose();
     auto x = p.first;
     p = p.second->decompose();
     auto y = p.first;
-    if (!p.second->as_nil()) throw error_t("eval_plus: unexpected '" + p.second->show() + "'");
+    if (!p.second->as_nil()) throw error_t("eval_plus: unexpected '" + p.second->show(print_brief) + "'");
 
     auto ret = nil();
     auto op = std::plus<>();
@@ -32,8 +542,8 @@ namespace lisp_interpreter {
       [&ret, &op] (int64_t x, int64_t y) { ret = atom(op(x, y)); },
       [&ret, &op] (int64_t x, double  y) { ret = atom(op(x, y)); },
       [&ret, &op] (double  x, int64_t y) { ret = atom(op(x, y)); },
-      [&ret, &op] (object_string_sptr_t x, object_string_sptr_t y) { ret = string(op(x->value, y->value)); },
-      [t] (auto, auto) { throw error_t("eval_plus: unexpected types in '" + t->show() + "'"); },
+      [&ret, &ctx] (object_string_sptr_t x, object_string_sptr_t y) { ret = string_concat(x, y, ctx); },
+      [t] (auto, auto) { throw error_t("eval_plus: unexpected types in '" + t->show(print_brief) + "'"); },
     }, x->value, y->value);
     return ret;
   }
@@ -44,7 +554,7 @@ namespace lisp_interpreter {
     auto x = p.first;
     p = p.second->decompose();
     auto y = p.first;
-    if (!p.second->as_nil()) throw error_t("eval_minus: unexpected '" + p.second->show() + "'");
+    if (!p.second->as_nil()) throw error_t("eval_minus: unexpected '" + p.second->show(print_brief) + "'");
 
     auto ret = nil();
     auto op = std::minus<>();
@@ -55,7 +565,7 @@ namespace lisp_interpreter {
       [&ret, &op] (int64_t x, int64_t y) { ret = atom(op(x, y)); },
       [&ret, &op] (int64_t x, double  y) { ret = atom(op(x, y)); },
       [&ret, &op] (double  x, int64_t y) { ret = atom(op(x, y)); },
-      [t] (auto, auto) { throw error_t("eval_minus: unexpected types in '" + t->show() + "'"); },
+      [t] (auto, auto) { throw error_t("eval_minus: unexpected types in '" + t->show(print_brief) + "'"); },
     }, x->value, y->value);
     return ret;
   }
@@ -66,7 +576,7 @@ namespace lisp_interpreter {
     auto x = p.first;
     p = p.second->decompose();
     auto y = p.first;
-    if (!p.second->as_nil()) throw error_t("eval_multiplies: unexpected '" + p.second->show() + "'");
+    if (!p.second->as_nil()) throw error_t("eval_multiplies: unexpected '" + p.second->show(print_brief) + "'");
 
     auto ret = nil();
     auto op = std::multiplies<>();
@@ -77,7 +587,7 @@ namespace lisp_interpreter {
       [&ret, &op] (int64_t x, int64_t y) { ret = atom(op(x, y)); },
       [&ret, &op] (int64_t x, double  y) { ret = atom(op(x, y)); },
       [&ret, &op] (double  x, int64_t y) { ret = atom(op(x, y)); },
-      [t] (auto, auto) { throw error_t("eval_multiplies: unexpected types in '" + t->show() + "'"); },
+      [t] (auto, auto) { throw error_t("eval_multiplies: unexpected types in '" + t->show(print_brief) + "'"); },
     }, x->value, y->value);
     return ret;
   }
@@ -88,103 +598,312 @@ namespace lisp_interpreter {
     auto x = p.first;
     p = p.second->decompose();
     auto y = p.first;
-    if (!p.second->as_nil()) throw error_t("eval_equal: unexpected '" + p.second->show() + "'");
+    if (!p.second->as_nil()) throw error_t("eval_equal: unexpected '" + p.second->show(print_brief) + "'");
 
     auto ret = nil();
     auto op = std::equal_to<>();
-    x = x->eval(env, ctx);
-    y = y->eval(env, ctx);
+    x = seq_to_list(x->eval(env, ctx), ctx);
+    y = seq_to_list(y->eval(env, ctx), ctx);
+    if ((x->as_list() || x->as_nil()) && (y->as_list() || y->as_nil())) return atom(equal(x, y));
+    if (x->as_map() && y->as_map()) return atom(equal(x, y));
+    if (x->as_vec() && y->as_vec()) return atom(equal(x, y));
     std::visit(overloaded {
       [&ret, &op] (bool    x, bool    y) { ret = atom(op(x, y)); },
       [&ret, &op] (double  x, double  y) { ret = atom(op(x, y)); },
       [&ret, &op] (int64_t x, int64_t y) { ret = atom(op(x, y)); },
       [&ret, &op] (int64_t x, double  y) { ret = atom(op(x, y)); },
       [&ret, &op] (double  x, int64_t y) { ret = atom(op(x, y)); },
-      [&ret, &op] (object_string_sptr_t x, object_string_sptr_t y) { ret = atom(op(x->value, y->value)); },
-      [t] (auto, auto) { throw error_t("eval_equal: unexpected types in '" + t->show() + "'"); },
+      [&ret] (object_string_sptr_t x, object_string_sptr_t y) { ret = atom(x->equals(*y)); },
+      [t] (auto, auto) { throw error_t("eval_equal: unexpected types in '" + t->show(print_brief) + "'"); },
     }, x->value, y->value);
     return ret;
   }
 
   object_sptr_t object_t::eval_less(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
     DEBUG_LOGGER_TRACE_LISP;
-    DEBUG_LOGGER_LISP("t: %s", t->show().c_str());
-    DEBUG_LOGGER_LISP("env: %p", env.get());
+    DEBUG_LOGGER_LISP("t", t);
+    DEBUG_LOGGER_LISP("env", env.get());
     auto p = t->decompose();
     auto x = p.first;
     p = p.second->decompose();
     auto y = p.first;
-    if (!p.second->as_nil()) throw error_t("eval_less: unexpected '" + p.second->show() + "'");
+    if (!p.second->as_nil()) throw error_t("eval_less: unexpected '" + p.second->show(print_brief) + "'");
 
     auto ret = nil();
     auto op = std::less<>();
     x = x->eval(env, ctx);
     y = y->eval(env, ctx);
-    DEBUG_LOGGER_LISP("x: %s", x->show().c_str());
-    DEBUG_LOGGER_LISP("y: %s", y->show().c_str());
+    DEBUG_LOGGER_LISP("x", x);
+    DEBUG_LOGGER_LISP("y", y);
     std::visit(overloaded {
       [&ret, &op] (double  x, double  y) { ret = atom(op(x, y)); },
       [&ret, &op] (int64_t x, int64_t y) { ret = atom(op(x, y)); },
       [&ret, &op] (int64_t x, double  y) { ret = atom(op(x, y)); },
       [&ret, &op] (double  x, int64_t y) { ret = atom(op(x, y)); },
-      [&ret, &op] (object_string_sptr_t x, object_string_sptr_t y) { ret = atom(op(x->value, y->value)); },
-      [t] (auto, auto) { throw error_t("eval_less: unexpected types in '" + t->show() + "'"); },
+      [&ret] (object_string_sptr_t x, object_string_sptr_t y) { ret = atom(x->compare(*y) < 0); },
+      [t] (auto, auto) { throw error_t("eval_less: unexpected types in '" + t->show(print_brief) + "'"); },
     }, x->value, y->value);
     return ret;
   }
 
+  // (substring s from [to]), bytes [from, to) sharing the buffer of s; to defaults to the end.
+  object_sptr_t object_t::eval_substring(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto str = p.first;
+    p = p.second->decompose();
+    auto from = p.first;
+    object_sptr_t to;
+    if (!p.second->as_nil()) {
+      p = p.second->decompose();
+      to = p.first;
+      if (!p.second->as_nil()) throw error_t("eval_substring: unexpected '" + p.second->show(print_brief) + "'");
+    }
+
+    str = str->eval(env, ctx);
+    auto sstr = str->as_string();
+    if (!sstr) throw error_t("eval_substring: argument #1 is not string");
+    auto size = static_cast<int64_t>((*sstr)->size());
+
+    from = from->eval(env, ctx);
+    auto ifrom = std::get_if<int64_t>(&from->value);
+    if (!ifrom) throw error_t("eval_substring: argument #2 is not int");
+
+    int64_t end = size;
+    if (to) {
+      to = to->eval(env, ctx);
+      auto ito = std::get_if<int64_t>(&to->value);
+      if (!ito) throw error_t("eval_substring: argument #3 is not int");
+      end = *ito;
+    }
+
+    if (*ifrom < 0 || *ifrom > end || end > size) {
+      throw error_t("eval_substring: range [" + std::to_string(*ifrom) + ", " + std::to_string(end) + ") is out of '" + str->show(print_brief) + "'");
+    }
+    if (*ifrom == 0 && end == size) return str;
+    return string_slice(*sstr, *ifrom, end, ctx);
+  }
+
+  object_sptr_t object_t::eval_string_length(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto str = p.first;
+    if (!p.second->as_nil()) throw error_t("eval_string_length: unexpected '" + p.second->show(print_brief) + "'");
+
+    str = str->eval(env, ctx);
+    auto sstr = str->as_string();
+    if (!sstr) throw error_t("eval_string_length: argument #1 is not string");
+    return atom(static_cast<int64_t>((*sstr)->size()));
+  }
+
+  // (string_find s needle [from]), index of the first needle at or after from, -1 when there is none.
+  object_sptr_t object_t::eval_string_find(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto str = p.first;
+    p = p.second->decompose();
+    auto needle = p.first;
+    object_sptr_t from;
+    if (!p.second->as_nil()) {
+      p = p.second->decompose();
+      from = p.first;
+      if (!p.second->as_nil()) throw error_t("eval_string_find: unexpected '" + p.second->show(print_brief) + "'");
+    }
+
+    str = str->eval(env, ctx);
+    auto sstr = str->as_string();
+    if (!sstr) throw error_t("eval_string_find: argument #1 is not string");
+
+    needle = needle->eval(env, ctx);
+    auto sneedle = needle->as_string();
+    if (!sneedle) throw error_t("eval_string_find: argument #2 is not string");
+
+    int64_t start = 0;
+    if (from) {
+      from = from->eval(env, ctx);
+      auto ifrom = std::get_if<int64_t>(&from->value);
+      if (!ifrom || *ifrom < 0) throw error_t("eval_string_find: argument #3 is not non-negative int");
+      start = *ifrom;
+    }
+
+    auto text = (*sstr)->flat();
+    if (static_cast<size_t>(start) > text.size()) return atom(int64_t(-1));
+    size_t pos = scan_find_str(text.data(), text.size(), (*sneedle)->flat(), start);
+    if (pos == text.size() && (*sneedle)->size()) return atom(int64_t(-1));
+    return atom(static_cast<int64_t>(pos));
+  }
+
+  // (string_count s needle), non-overlapping occurrences.
+  object_sptr_t object_t::eval_string_count(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto str = p.first;
+    p = p.second->decompose();
+    auto needle = p.first;
+    if (!p.second->as_nil()) throw error_t("eval_string_count: unexpected '" + p.second->show(print_brief) + "'");
+
+    str = str->eval(env, ctx);
+    auto sstr = str->as_string();
+    if (!sstr) throw error_t("eval_string_count: argument #1 is not string");
+
+    needle = needle->eval(env, ctx);
+    auto sneedle = needle->as_string();
+    if (!sneedle || !(*sneedle)->size()) throw error_t("eval_string_count: argument #2 is not non-empty string");
+
+    auto text = (*sstr)->flat();
+    auto pattern = (*sneedle)->flat();
+    if (pattern.size() == 1) return atom(static_cast<int64_t>(scan_count(text.data(), text.size(), pattern.front())));
+
+    int64_t ret = 0;
+    for (size_t pos = 0; (pos = scan_find_str(text.data(), text.size(), pattern, pos)) < text.size(); pos += pattern.size()) {
+      ret++;
+    }
+    return atom(ret);
+  }
+
+  // (string_split s sep), list of the parts between separators as slices of s.
+  object_sptr_t object_t::eval_string_split(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto str = p.first;
+    p = p.second->decompose();
+    auto sep = p.first;
+    if (!p.second->as_nil()) throw error_t("eval_string_split: unexpected '" + p.second->show(print_brief) + "'");
+
+    str = str->eval(env, ctx);
+    auto sstr = str->as_string();
+    if (!sstr) throw error_t("eval_string_split: argument #1 is not string");
+
+    sep = sep->eval(env, ctx);
+    auto ssep = sep->as_string();
+    if (!ssep || !(*ssep)->size()) throw error_t("eval_string_split: argument #2 is not non-empty string");
+
+    auto text = (*sstr)->flat();
+    auto pattern = (*ssep)->flat();
+    std::vector<std::pair<size_t, size_t>> parts;
+    size_t begin = 0;
+    while (true) {
+      size_t end = pattern.size() == 1
+        ? begin + scan_find(text.data() + begin, text.size() - begin, pattern.front())
+        : scan_find_str(text.data(), text.size(), pattern, begin);
+      parts.push_back({begin, end});
+      if (end == text.size()) break;
+      begin = end + pattern.size();
+    }
+
+    auto ret = nil();
+    for (auto it = parts.rbegin(); it != parts.rend(); ++it) {
+      ret = list(string_slice(*sstr, it->first, it->second, ctx), ret, ctx);
+    }
+    return ret;
+  }
+
+  // (string_replace s from to), every non-overlapping 'from' replaced.
+  object_sptr_t object_t::eval_string_replace(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto str = p.first;
+    p = p.second->decompose();
+    auto from = p.first;
+    p = p.second->decompose();
+    auto to = p.first;
+    if (!p.second->as_nil()) throw error_t("eval_string_replace: unexpected '" + p.second->show(print_brief) + "'");
+
+    str = str->eval(env, ctx);
+    auto sstr = str->as_string();
+    if (!sstr) throw error_t("eval_string_replace: argument #1 is not string");
+
+    from = from->eval(env, ctx);
+    auto sfrom = from->as_string();
+    if (!sfrom || !(*sfrom)->size()) throw error_t("eval_string_replace: argument #2 is not non-empty string");
+
+    to = to->eval(env, ctx);
+    auto sto = to->as_string();
+    if (!sto) throw error_t("eval_string_replace: argument #3 is not string");
+
+    auto text = (*sstr)->flat();
+    auto pattern = (*sfrom)->flat();
+    auto replacement = (*sto)->flat();
+    size_t pos = scan_find_str(text.data(), text.size(), pattern);
+    if (pos == text.size()) return str;
+
+    std::string ret;
+    ret.reserve(text.size());
+    size_t begin = 0;
+    for (; pos < text.size(); pos = scan_find_str(text.data(), text.size(), pattern, begin)) {
+      ret.append(text.substr(begin, pos - begin));
+      ret.append(replacement);
+      begin = pos + pattern.size();
+    }
+    ret.append(text.substr(begin));
+    return string(std::move(ret), ctx);
+  }
+
   object_sptr_t object_t::eval_def(object_sptr_t, object_sptr_t t, env_sptr_t env_eval, env_sptr_t env_def, context_t& ctx, bool need_eval) {
     DEBUG_LOGGER_TRACE_LISP;
-    DEBUG_LOGGER_LISP("t: %s", t->show().c_str());
-    DEBUG_LOGGER_LISP("env_eval: %p", env_eval.get());
-    DEBUG_LOGGER_LISP("env_def: %p", env_def.get());
+    DEBUG_LOGGER_LISP("t", t);
+    DEBUG_LOGGER_LISP("env_eval", env_eval.get());
+    DEBUG_LOGGER_LISP("env_def", env_def.get());
     auto p = t->decompose();
     auto name = p.first;
     p = p.second->decompose();
     auto object = p.first;
-    if (!p.second->as_nil()) throw error_t("eval_def: unexpected '" + p.second->show() + "'");
+    if (!p.second->as_nil()) throw error_t("eval_def: unexpected '" + p.second->show(print_brief) + "'");
 
     auto sname = name->as_ident();
     if (!sname) throw error_t("eval_def: argument #1 is not ident");
 
-    if (need_eval) object = object->eval(env_eval, ctx); // TODO lazy
-    DEBUG_LOGGER_LISP("object: %s", object->show().c_str());
+    if (need_eval && ctx.lazy_defs && object->as_list() && env_eval == env_def && (env_def->toplevel || !env_def->parent)) {
+      auto loc = (*object->as_list())->loc;
+      if (!loc.line) loc = (*t->as_list())->loc;
+      env_def->defvar((*sname)->value, thunk((*sname)->value, loc, object, env_eval));
+      return name;
+    }
+
+    if (need_eval) object = object->eval(env_eval, ctx);
+    if (auto lambda = object->as_lambda(); lambda && (*lambda)->name.empty()) {
+      (*lambda)->name = (*sname)->value;
+    } else if (auto macro = object->as_macro(); macro && (*macro)->name.empty()) {
+      (*macro)->name = (*sname)->value;
+    }
+    DEBUG_LOGGER_LISP("object", object);
 
     return env_def->defvar((*sname)->value, object);
   }
 
   object_sptr_t object_t::eval_println(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
     DEBUG_LOGGER_TRACE_LISP;
-    DEBUG_LOGGER_LISP("t: %s", t->show().c_str());
-    DEBUG_LOGGER_LISP("env: %p", env.get());
+    DEBUG_LOGGER_LISP("t", t);
+    DEBUG_LOGGER_LISP("env", env.get());
     t->for_each([&env, &ctx](object_sptr_t object) -> bool {
       auto obj = object->eval(env, ctx);
-      ctx.stream << obj->show();
-      DEBUG_LOGGER_LISP("stream: %s", obj->show().c_str());
+      obj->realize(ctx);
+      obj->print(*ctx.out);
+      DEBUG_LOGGER_LISP("out", obj);
       return true;
     });
-    ctx.stream << std::endl;
+    ctx.out->put('\n');
     return atom(true);
   }
 
   object_sptr_t object_t::eval_if(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
     DEBUG_LOGGER_TRACE_LISP;
-    DEBUG_LOGGER_LISP("t: %s", t->show().c_str());
-    DEBUG_LOGGER_LISP("env: %p", env.get());
+    DEBUG_LOGGER_LISP("t", t);
+    DEBUG_LOGGER_LISP("env", env.get());
     auto p = t->decompose();
     auto cond = p.first;
     p = p.second->decompose();
     auto consequent = p.first;
     p = p.second->decompose();
     auto alternative = p.first;
-    if (!p.second->as_nil()) throw error_t("eval_if: unexpected '" + p.second->show() + "'");
+    if (!p.second->as_nil()) throw error_t("eval_if: unexpected '" + p.second->show(print_brief) + "'");
 
     cond = cond->eval(env, ctx);
     auto cond_bool = cond->as_bool();
     if (!cond_bool) throw error_t("eval_if: argument #1 is not bool");
 
     auto ret = (*cond_bool ? consequent : alternative)->eval(env, ctx);
-    DEBUG_LOGGER_LISP("ret: %s", ret->show().c_str());
+    DEBUG_LOGGER_LISP("ret", ret);
     return ret;
   }
 
@@ -192,9 +911,9 @@ namespace lisp_interpreter {
     DEBUG_LOGGER_TRACE_LISP;
     auto p = t->decompose();
     auto tail = p.first;
-    if (!p.second->as_nil()) throw error_t("eval_quote: unexpected '" + p.second->show() + "'");
-    DEBUG_LOGGER_LISP("t: %s", t->show().c_str());
-    DEBUG_LOGGER_LISP("ret: %s", tail->show().c_str());
+    if (!p.second->as_nil()) throw error_t("eval_quote: unexpected '" + p.second->show(print_brief) + "'");
+    DEBUG_LOGGER_LISP("t", t);
+    DEBUG_LOGGER_LISP("ret", tail);
     return tail;
   }
 
@@ -202,9 +921,9 @@ namespace lisp_interpreter {
     DEBUG_LOGGER_TRACE_LISP;
     auto p = t->decompose();
     auto tail = p.first;
-    if (!p.second->as_nil()) throw error_t("eval_eval: unexpected '" + p.second->show() + "'");
-    DEBUG_LOGGER_LISP("t: %s", t->show().c_str());
-    DEBUG_LOGGER_LISP("ret: %s", tail->show().c_str());
+    if (!p.second->as_nil()) throw error_t("eval_eval: unexpected '" + p.second->show(print_brief) + "'");
+    DEBUG_LOGGER_LISP("t", t);
+    DEBUG_LOGGER_LISP("ret", tail);
     return tail->eval(env, ctx);
   }
 
@@ -214,20 +933,25 @@ namespace lisp_interpreter {
     auto head = p.first;
     p = p.second->decompose();
     auto tail = p.first;
-    if (!p.second->as_nil()) throw error_t("eval_cons: unexpected '" + p.second->show() + "'");
+    if (!p.second->as_nil()) throw error_t("eval_cons: unexpected '" + p.second->show(print_brief) + "'");
 
     head = head->eval(env, ctx);
     tail = tail->eval(env, ctx);
-    return head->cons(tail);
+    return head->cons(tail, ctx);
   }
 
   object_sptr_t object_t::eval_head(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
     DEBUG_LOGGER_TRACE_LISP;
     auto p = t->decompose();
     auto l = p.first;
-    if (!p.second->as_nil()) throw error_t("eval_head: unexpected '" + p.second->show() + "'");
+    if (!p.second->as_nil()) throw error_t("eval_head: unexpected '" + p.second->show(print_brief) + "'");
 
     l = l->eval(env, ctx);
+    if (auto seq = l->as_seq()) {
+      auto& forced = seq_force(**seq, ctx);
+      if (!forced.first) throw error_t("eval_head: sequence is empty");
+      return forced.first;
+    }
     return l->head();
   }
 
@@ -235,9 +959,14 @@ namespace lisp_interpreter {
     DEBUG_LOGGER_TRACE_LISP;
     auto p = t->decompose();
     auto l = p.first;
-    if (!p.second->as_nil()) throw error_t("eval_tail: unexpected '" + p.second->show() + "'");
+    if (!p.second->as_nil()) throw error_t("eval_tail: unexpected '" + p.second->show(print_brief) + "'");
 
     l = l->eval(env, ctx);
+    if (auto seq = l->as_seq()) {
+      auto& forced = seq_force(**seq, ctx);
+      if (!forced.first) throw error_t("eval_tail: sequence is empty");
+      return forced.rest;
+    }
     return l->tail();
   }
 
@@ -245,57 +974,47 @@ namespace lisp_interpreter {
     DEBUG_LOGGER_TRACE_LISP;
     auto p = t->decompose();
     auto l = p.first;
-    if (!p.second->as_nil()) throw error_t("eval_typeof: unexpected '" + p.second->show() + "'");
+    if (!p.second->as_nil()) throw error_t("eval_typeof: unexpected '" + p.second->show(print_brief) + "'");
 
     l = l->eval(env, ctx);
+    if (auto seq = l->as_seq()) {
+      return string(seq_force(**seq, ctx).first ? "list" : "nil", ctx);
+    }
 
-    std::string ret;
-    std::visit(overloaded {
-      [&ret] (object_nil_sptr_t)     { ret = "nil"; },
-      [&ret] (bool)                  { ret = "bool"; },
-      [&ret] (int64_t)               { ret = "int"; },
-      [&ret] (double)                { ret = "double"; },
-      [&ret] (object_string_sptr_t)  { ret = "string"; },
-      [&ret] (object_ident_sptr_t)   { ret = "ident"; },
-      [&ret] (object_list_sptr_t)    { ret = "list"; },
-      [&ret] (object_lambda_sptr_t)  { ret = "lambda"; },
-      [&ret] (object_macro_sptr_t)   { ret = "macro"; },
-    }, l->value);
-
-    return string(ret);
+    return string(type_name(l->value.index()), ctx);
   }
 
   object_sptr_t object_t::eval_lambda(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t&) {
     DEBUG_LOGGER_TRACE_LISP;
-    DEBUG_LOGGER_LISP("t: %s", t->show().c_str());
-    DEBUG_LOGGER_LISP("env: %p", env.get());
+    DEBUG_LOGGER_LISP("t", t);
+    DEBUG_LOGGER_LISP("env", env.get());
     auto p = t->decompose();
     auto args = p.first;
     p = p.second->decompose();
     auto body = p.first;
-    if (!p.second->as_nil()) throw error_t("eval_lambda: unexpected '" + p.second->show() + "'");
+    if (!p.second->as_nil()) throw error_t("eval_lambda: unexpected '" + p.second->show(print_brief) + "'");
 
     if (!args->as_list() && !args->as_nil()) throw error_t("eval_lambda: argument #1 is not list");
 
-    DEBUG_LOGGER_LISP("args: %s", args->show().c_str());
-    DEBUG_LOGGER_LISP("body: %s", body->show().c_str());
-    DEBUG_LOGGER_LISP("env:  %p", env.get());
+    DEBUG_LOGGER_LISP("args", args);
+    DEBUG_LOGGER_LISP("body", body);
+    DEBUG_LOGGER_LISP("env", env.get());
     return lambda(args, body, env);
   }
 
   object_sptr_t object_t::eval_macro(object_sptr_t, object_sptr_t t, env_sptr_t, context_t&) {
     DEBUG_LOGGER_TRACE_LISP;
-    DEBUG_LOGGER_LISP("t: %s", t->show().c_str());
+    DEBUG_LOGGER_LISP("t", t);
     auto p = t->decompose();
     auto args = p.first;
     p = p.second->decompose();
     auto body = p.first;
-    if (!p.second->as_nil()) throw error_t("eval_macro: unexpected '" + p.second->show() + "'");
+    if (!p.second->as_nil()) throw error_t("eval_macro: unexpected '" + p.second->show(print_brief) + "'");
 
     if (!args->as_list() && !args->as_nil()) throw error_t("eval_macro: argument #1 is not list");
 
-    DEBUG_LOGGER_LISP("args: %s", args->show().c_str());
-    DEBUG_LOGGER_LISP("body: %s", body->show().c_str());
+    DEBUG_LOGGER_LISP("args", args);
+    DEBUG_LOGGER_LISP("body", body);
     return macro(args, body);
   }
 
@@ -303,75 +1022,903 @@ namespace lisp_interpreter {
     DEBUG_LOGGER_TRACE_LISP;
     auto p = t->decompose();
     auto name = p.first;
-    if (!p.second->as_nil()) throw error_t("eval_load: unexpected '" + p.second->show() + "'");
+    if (!p.second->as_nil()) throw error_t("eval_load: unexpected '" + p.second->show(print_brief) + "'");
 
     auto sname = name->as_string();
     if (!sname) throw error_t("eval_load: argument #1 is not string");
 
-    std::ifstream ifs((*sname)->value);
-    std::string content((std::istreambuf_iterator<char>(ifs)), (std::istreambuf_iterator<char>()));
+    std::error_code ec;
+    auto path = std::filesystem::canonical((*sname)->flat(), ec);
+    if (ec) throw error_t("eval_load: file '" + std::string((*sname)->flat()) + "' is not exists");
+
+    env_t::module_t module;
+    module.mtime = std::filesystem::last_write_time(path, ec);
+    if (ec) throw error_t("eval_load: file '" + path.string() + "' is not readable");
+    module.size = std::filesystem::file_size(path, ec);
+    if (ec) throw error_t("eval_load: file '" + path.string() + "' is not readable");
 
-    auto ret = parse(content);
-    ret = ret->eval(env, ctx);
+    auto loaded = env->find_module(path.string());
+    if (loaded && loaded->mtime == module.mtime && loaded->size == module.size) {
+      DEBUG_LOGGER_LISP("module loaded", loaded->result);
+      return loaded->result;
+    }
+
+    // Top-level (def name ...) forms that clash are rejected before any form runs,
+    // defs made otherwise are checked by commit_module after the whole file.
+    auto forms = parse_file(path.string());
+    std::vector<std::string> keys;
+    forms->for_each([&keys](object_sptr_t form) -> bool {
+      if (!form->as_list()) return true;
+      auto head = form->head()->as_ident();
+      if (!head || ((*head)->value != "def" && (*head)->value != "__kernel_def")) return true;
+      auto rest = form->tail();
+      if (auto name = rest->as_list() ? rest->head()->as_ident() : nullptr) keys.push_back((*name)->value);
+      return true;
+    });
+    env->check_module(path.string(), keys);
+
+    auto env_module = std::make_shared<env_t>(env);
+    env_module->toplevel = true;
+    ctx.metrics.env_frames++;
+    auto ret = nil();
+    forms->for_each([&ret, &env_module, &ctx](object_sptr_t form) -> bool {
+      ret = form->eval(env_module, ctx);
+      return true;
+    });
+
+    module.result = ret;
+    env->commit_module(path.string(), std::move(module), *env_module);
     return ret;
   }
 
-  object_sptr_t object_t::eval_call_lambda(object_sptr_t h, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+  object_sptr_t object_t::eval_load_data(object_sptr_t, object_sptr_t t, env_sptr_t, context_t& ctx) {
     DEBUG_LOGGER_TRACE_LISP;
-    DEBUG_LOGGER_LISP("h: %s", h->show().c_str());
-    DEBUG_LOGGER_LISP("t: %s", t->show().c_str());
-    DEBUG_LOGGER_LISP("env: %p", env.get());
-
-    auto lambda = h->as_lambda();
-    if (!lambda) throw error_t("eval_call_lambda: argument #0 is not lambda");
+    auto p = t->decompose();
+    auto name = p.first;
+    if (!p.second->as_nil()) throw error_t("eval_load_data: unexpected '" + p.second->show(print_brief) + "'");
 
-    auto env_lambda = std::make_shared<env_t>((*lambda)->env);
+    auto sname = name->as_string();
+    if (!sname) throw error_t("eval_load_data: argument #1 is not string");
 
-    DEBUG_LOGGER_LISP("env_lambda_origin: %p", (*lambda)->env.get());
-    DEBUG_LOGGER_LISP("env_lambda: %p", env_lambda.get());
-    DEBUG_LOGGER_LISP("args: %s", (*lambda)->args->show().c_str());
-    DEBUG_LOGGER_LISP("body: %s", (*lambda)->body->show().c_str());
+    auto ret = parse_file(std::string((*sname)->flat()));
+    return ctx.hash_consing ? intern(ret) : ret;
+  }
 
-    (*lambda)->args->for_each([&t, &env, &env_lambda, &ctx](object_sptr_t object) -> bool {
-      auto p = t->decompose();
-      t = p.second;
-      auto arg = object->cons(p.first->cons(nil()));
-      auto val = eval_def(nil(), arg, env, env_lambda, ctx);
-      DEBUG_LOGGER_LISP("arg: %s", arg->show().c_str());
-      DEBUG_LOGGER_LISP("val: %s", val->show().c_str());
-      return true;
-    });
+  object_sptr_t object_t::eval_hash(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto x = p.first;
+    if (!p.second->as_nil()) throw error_t("eval_hash: unexpected '" + p.second->show(print_brief) + "'");
 
-    auto ret = (*lambda)->body->eval(env_lambda, ctx);
-    DEBUG_LOGGER_LISP("ret: %s", ret->show().c_str());
-    return ret;
+    x = seq_to_list(x->eval(env, ctx), ctx);
+    return atom(static_cast<int64_t>(x->hash()));
   }
 
-  object_sptr_t object_t::eval_call_macro(object_sptr_t h, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+  // (hash_consing flag), returns the previous mode.
+  object_sptr_t object_t::eval_hash_consing(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
     DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto x = p.first;
+    if (!p.second->as_nil()) throw error_t("eval_hash_consing: unexpected '" + p.second->show(print_brief) + "'");
 
-    auto macro = h->as_macro();
-    if (!macro) throw error_t("eval_call_macro: argument #0 is not macro");
+    x = x->eval(env, ctx);
+    auto flag = x->as_bool();
+    if (!flag) throw error_t("eval_hash_consing: argument #1 is not bool");
 
-    auto env_macro = std::make_shared<env_t>();
+    bool prev = ctx.hash_consing;
+    ctx.hash_consing = *flag;
+    return atom(prev);
+  }
 
-    (*macro)->args->for_each([&t, &env, &env_macro, &ctx] (object_sptr_t object) -> bool {
-      auto p = t->decompose();
-      t = p.second;
-      auto arg = object->cons(p.first->cons(nil()));
-      auto val = eval_def(nil(), arg, env, env_macro, ctx, false);
-      return true;
-    });
+  // (lazy_defs flag), returns the previous mode.
+  object_sptr_t object_t::eval_lazy_defs(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto x = p.first;
+    if (!p.second->as_nil()) throw error_t("eval_lazy_defs: unexpected '" + p.second->show(print_brief) + "'");
+
+    x = x->eval(env, ctx);
+    auto flag = x->as_bool();
+    if (!flag) throw error_t("eval_lazy_defs: argument #1 is not bool");
+
+    bool prev = ctx.lazy_defs;
+    ctx.lazy_defs = *flag;
+    return atom(prev);
+  }
+
+  object_sptr_t object_t::lookup(env_sptr_t env, const std::string& name, context_t& ctx) {
+    auto ret = env->getvar(name);
+    if (auto thunk = ret->as_thunk()) {
+      ret = force(**thunk, ctx);
+      env->setvar(name, ret);
+    }
+    return ret;
+  }
+
+  // Errors keep the thunk, the next lookup evaluates it again.
+  object_sptr_t object_t::force(const object_thunk_t& thunk, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    if (thunk.value) return thunk.value;
+    if (thunk.forcing) throw error_t("force: lazy def '" + thunk.name + "' depends on itself");
+
+    thunk.forcing = true;
+    object_sptr_t object;
+    try {
+      object = thunk.expr->eval(thunk.env, ctx);
+    } catch (const error_t& e) {
+      thunk.forcing = false;
+      throw error_t("force: lazy def '" + thunk.name + "' at " + thunk.loc.show() + ": " + e.what());
+    } catch (...) {
+      thunk.forcing = false;
+      throw;
+    }
+    thunk.forcing = false;
+
+    if (auto lambda = object->as_lambda(); lambda && (*lambda)->name.empty()) {
+      (*lambda)->name = thunk.name;
+    } else if (auto macro = object->as_macro(); macro && (*macro)->name.empty()) {
+      (*macro)->name = thunk.name;
+    }
+    DEBUG_LOGGER_LISP("object", object);
+
+    thunk.value = object;
+    thunk.expr = nullptr;
+    thunk.env = nullptr;
+    return object;
+  }
+
+  object_sptr_t object_t::eval_open(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto name = p.first;
+    p = p.second->decompose();
+    auto mode = p.first;
+    if (!p.second->as_nil()) throw error_t("eval_open: unexpected '" + p.second->show(print_brief) + "'");
+
+    name = name->eval(env, ctx);
+    auto sname = name->as_string();
+    if (!sname) throw error_t("eval_open: argument #1 is not string");
+
+    mode = mode->eval(env, ctx);
+    auto smode = mode->as_string();
+    if (!smode) throw error_t("eval_open: argument #2 is not string");
+
+    auto file = std::make_shared<object_file_t>(std::string((*sname)->flat()));
+    auto mode_str = (*smode)->flat();
+    if (mode_str == "r") {
+      file->reader = std::make_unique<line_reader_t>(file->path);
+      if (!file->reader->is_open()) throw error_t("eval_open: file '" + file->path + "' is not readable");
+    } else if (mode_str == "w" || mode_str == "a") {
+      int fd = file_writer_t::open(file->path, mode_str == "a");
+      if (fd < 0) throw error_t("eval_open: file '" + file->path + "' is not writable");
+      file->writer = std::make_unique<file_writer_t>(fd);
+    } else {
+      throw error_t("eval_open: unknown mode '" + std::string(mode_str) + "'");
+    }
+    return atom(object_file_sptr_t(file));
+  }
+
+  object_sptr_t object_t::eval_close(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto f = p.first;
+    if (!p.second->as_nil()) throw error_t("eval_close: unexpected '" + p.second->show(print_brief) + "'");
+
+    f = f->eval(env, ctx);
+    auto file = f->as_file();
+    if (!file) throw error_t("eval_close: argument #1 is not file");
+
+    (*file)->reader.reset();
+    (*file)->writer.reset();
+    return atom(true);
+  }
+
+  // Strings are slices of the mapping, they keep it after the file is closed.
+  // Hash-consed strings are copied, as string_slice does.
+  object_sptr_t object_t::line_value(const line_reader_t& reader, std::string_view line, char sep, const context_t& ctx) {
+    auto mapping = reader.mapping();
+    object_string_t::buffer_t buffer(mapping, mapping->view().data());
+    auto field = [&buffer, &ctx] (std::string_view str) -> object_sptr_t {
+      if (ctx.hash_consing) return intern_string(std::string(str));
+      auto l = std::make_shared<object_string_t>(buffer, str.data() - buffer.get(), str.size());
+      return std::make_shared<object_t>(object_string_sptr_t(l));
+    };
+    if (!sep) return field(line);
+
+    auto ret = nil();
+    while (true) {
+      auto pos = line.rfind(sep);
+      ret = field(line.substr(pos == std::string_view::npos ? 0 : pos + 1))->cons(ret, ctx);
+      if (pos == std::string_view::npos) break;
+      line = line.substr(0, pos);
+    }
+    return ret;
+  }
+
+  // (read_line file [sep])
+  object_sptr_t object_t::eval_read_line(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto f = p.first;
+    char sep = 0;
+    if (!p.second->as_nil()) {
+      p = p.second->decompose();
+      auto s = p.first->eval(env, ctx);
+      auto ssep = s->as_string();
+      if (!ssep || (*ssep)->size() != 1) throw error_t("eval_read_line: argument #2 is not one char string");
+      sep = (*ssep)->flat()[0];
+      if (!p.second->as_nil()) throw error_t("eval_read_line: unexpected '" + p.second->show(print_brief) + "'");
+    }
+
+    f = f->eval(env, ctx);
+    auto file = f->as_file();
+    if (!file || !(*file)->reader) throw error_t("eval_read_line: argument #1 is not file opened for reading");
+
+    std::string_view line;
+    if (!(*file)->reader->next(line)) return nil();
+    return line_value(*(*file)->reader, line, sep, ctx);
+  }
+
+  // (fold_lines f acc file [sep]), f is called as (f line acc) for each line.
+  object_sptr_t object_t::eval_fold_lines(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto f = p.first->eval(env, ctx);
+    p = p.second->decompose();
+    auto acc = p.first->eval(env, ctx);
+    p = p.second->decompose();
+    auto fl = p.first->eval(env, ctx);
+    char sep = 0;
+    if (!p.second->as_nil()) {
+      p = p.second->decompose();
+      auto s = p.first->eval(env, ctx);
+      auto ssep = s->as_string();
+      if (!ssep || (*ssep)->size() != 1) throw error_t("eval_fold_lines: argument #4 is not one char string");
+      sep = (*ssep)->flat()[0];
+      if (!p.second->as_nil()) throw error_t("eval_fold_lines: unexpected '" + p.second->show(print_brief) + "'");
+    }
+
+    if (!f->is_function()) throw error_t("eval_fold_lines: argument #1 is not function");
+    auto file = fl->as_file();
+    if (!file || !(*file)->reader) throw error_t("eval_fold_lines: argument #3 is not file opened for reading");
+
+    std::string_view line;
+    while ((*file)->reader->next(line)) {
+      acc = apply_lambda(f, {line_value(*(*file)->reader, line, sep, ctx), acc}, ctx, env);
+    }
+    return acc;
+  }
+
+  // Strings are written without quotes, other objects as println shows them.
+  object_sptr_t object_t::eval_write(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx, bool newline) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto f = p.first->eval(env, ctx);
+    auto file = f->as_file();
+    if (!file || !(*file)->writer) throw error_t("eval_write: argument #1 is not file opened for writing");
+
+    auto& out = *(*file)->writer;
+    p.second->for_each([&env, &ctx, &out](object_sptr_t object) -> bool {
+      auto obj = object->eval(env, ctx);
+      if (auto str = obj->as_string()) {
+        (*str)->for_each_chunk([&out] (std::string_view chunk) { out.write(chunk); });
+      } else {
+        obj->realize(ctx);
+        obj->print(out);
+      }
+      return true;
+    });
+    if (newline) out.put('\n');
+    return atom(true);
+  }
+
+  std::pair<object_t::object_seq_t::cursor_t, object_t::object_seq_t::stages_t> object_t::seq_view(object_sptr_t object, const char* fn, const context_t& ctx) {
+    if (object->as_list() || object->as_nil()) return {{object, 0, 0}, nullptr};
+    if (auto m = object->as_map()) return {{map_entries((*m)->map, ctx), 0, 0}, nullptr};
+    auto seq = object->as_seq();
+    if (!seq) throw error_t(std::string(fn) + ": argument is not list");
+    // Another holder may walk the seq again, its cells are forced and kept so
+    // the stages run once per element. Ranges without stages are just counted.
+    if ((*seq)->forced || ((*seq)->stages && object.use_count() > 1)) return {{object, 0, 0}, nullptr};
+    return {(*seq)->cursor, (*seq)->stages};
+  }
+
+  bool object_t::seq_next(object_seq_t::cursor_t& cursor, const object_seq_t::stages_t& stages, object_sptr_t& value, context_t& ctx) {
+    while (true) {
+      object_sptr_t x;
+      if (!cursor.source) {
+        if (cursor.from >= cursor.to) return false;
+        x = atom(cursor.from++);
+      } else if (auto list = cursor.source->as_list()) {
+        x = (*list)->head;
+        cursor.source = (*list)->tail;
+      } else if (auto seq = cursor.source->as_seq()) {
+        auto& forced = seq_force(**seq, ctx);
+        if (!forced.first) return false;
+        x = forced.first;
+        cursor.source = forced.rest;
+      } else {
+        return false;
+      }
+
+      bool pass = true;
+      for (size_t i = 0; pass && stages && i < stages->size(); i++) {
+        const auto& stage = (*stages)[i];
+        auto y = apply_lambda(stage.f, {x}, ctx, stage.env);
+        if (!stage.filter) {
+          x = y;
+          continue;
+        }
+        auto b = y->as_bool();
+        if (!b) throw error_t("seq_next: filter result is not bool");
+        pass = *b;
+      }
+      if (pass) {
+        value = x;
+        return true;
+      }
+    }
+  }
+
+  const object_t::object_seq_t& object_t::seq_force(const object_seq_t& seq, context_t& ctx) {
+    if (seq.forced) return seq;
+    auto cursor = seq.cursor;
+    object_sptr_t value;
+    if (seq_next(cursor, seq.stages, value, ctx)) {
+      seq.first = value;
+      seq.rest = atom(object_seq_sptr_t(std::make_shared<object_seq_t>(cursor, seq.stages)));
+    } else {
+      seq.first = nullptr;
+      seq.rest = nil();
+    }
+    seq.forced = true;
+    return seq;
+  }
+
+  object_sptr_t object_t::seq_to_list(object_sptr_t object, context_t& ctx) {
+    auto tail = object;
+    while (auto list = tail->as_list()) {
+      tail = (*list)->tail;
+    }
+    if (!tail->as_seq()) return object;
+    tail = nullptr;
+    auto [cursor, stages] = seq_view(std::move(object), "seq_to_list", ctx);
+    std::vector<object_sptr_t> items;
+    object_sptr_t value;
+    while (seq_next(cursor, stages, value, ctx)) {
+      items.push_back(value);
+    }
+    auto ret = nil();
+    for (auto it = items.rbegin(); it != items.rend(); ++it) {
+      ret = list(*it, ret, ctx);
+    }
+    return ret;
+  }
+
+  object_sptr_t object_t::eval_range(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto from = p.first;
+    p = p.second->decompose();
+    auto to = p.first;
+    if (!p.second->as_nil()) throw error_t("eval_range: unexpected '" + p.second->show(print_brief) + "'");
+
+    from = from->eval(env, ctx);
+    auto ifrom = std::get_if<int64_t>(&from->value);
+    if (!ifrom) throw error_t("eval_range: argument #1 is not int");
+
+    to = to->eval(env, ctx);
+    auto ito = std::get_if<int64_t>(&to->value);
+    if (!ito) throw error_t("eval_range: argument #2 is not int");
+
+    return atom(object_seq_sptr_t(std::make_shared<object_seq_t>(object_seq_t::cursor_t{nullptr, *ifrom, *ito}, nullptr)));
+  }
+
+  // (map f l) and (filter f l), the stage is appended to an unforced seq.
+  object_sptr_t object_t::eval_stage(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx, bool filter) {
+    DEBUG_LOGGER_TRACE_LISP;
+    const char* fn = filter ? "eval_filter" : "eval_map";
+    auto p = t->decompose();
+    auto f = p.first;
+    p = p.second->decompose();
+    auto l = p.first;
+    if (!p.second->as_nil()) throw error_t(fn + ": unexpected '"s + p.second->show(print_brief) + "'");
+
+    f = f->eval(env, ctx);
+    if (!f->is_function()) throw error_t(fn + ": argument #1 is not function"s);
+
+    auto [cursor, stages] = seq_view(l->eval(env, ctx), fn, ctx);
+    auto stages_new = stages ? std::make_shared<std::vector<object_seq_t::stage_t>>(*stages)
+                             : std::make_shared<std::vector<object_seq_t::stage_t>>();
+    stages_new->push_back({filter, f, f->as_macro() ? env : nullptr});
+    return atom(object_seq_sptr_t(std::make_shared<object_seq_t>(cursor, stages_new)));
+  }
+
+  // (foldl f acc l), f is called as (f x acc). A chain of map/filter over a
+  // range or list is read in one pass.
+  object_sptr_t object_t::eval_foldl(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto f = p.first;
+    p = p.second->decompose();
+    auto acc = p.first;
+    p = p.second->decompose();
+    auto l = p.first;
+    if (!p.second->as_nil()) throw error_t("eval_foldl: unexpected '" + p.second->show(print_brief) + "'");
+
+    f = f->eval(env, ctx);
+    if (!f->is_function()) throw error_t("eval_foldl: argument #1 is not function");
+    acc = acc->eval(env, ctx);
+
+    auto [cursor, stages] = seq_view(l->eval(env, ctx), "eval_foldl", ctx);
+    object_sptr_t value;
+    while (seq_next(cursor, stages, value, ctx)) {
+      acc = apply_lambda(f, {value, acc}, ctx, env);
+    }
+    return acc;
+  }
+
+  object_sptr_t object_t::map_entries(const hamt_map_t& map, const context_t& ctx) {
+    std::vector<std::pair<object_sptr_t, object_sptr_t>> entries;
+    entries.reserve(map.size());
+    map.for_each([&entries] (const object_sptr_t& key, const object_sptr_t& value) {
+      entries.push_back({key, value});
+    });
+    auto ret = nil();
+    for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+      ret = list(list(it->first, list(it->second, nil(), ctx), ctx), ret, ctx);
+    }
+    return ret;
+  }
+
+  // (assoc map key value)
+  object_sptr_t object_t::eval_assoc(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto m = p.first;
+    p = p.second->decompose();
+    auto key = p.first;
+    p = p.second->decompose();
+    auto val = p.first;
+    if (!p.second->as_nil()) throw error_t("eval_assoc: unexpected '" + p.second->show(print_brief) + "'");
+
+    m = m->eval(env, ctx);
+    auto mm = m->as_map();
+    if (!mm) throw error_t("eval_assoc: argument #1 is not map");
+
+    key = seq_to_list(key->eval(env, ctx), ctx);
+    val = val->eval(env, ctx);
+    return map((*mm)->map.assoc(key, val));
+  }
+
+  // (dissoc map key)
+  object_sptr_t object_t::eval_dissoc(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto m = p.first;
+    p = p.second->decompose();
+    auto key = p.first;
+    if (!p.second->as_nil()) throw error_t("eval_dissoc: unexpected '" + p.second->show(print_brief) + "'");
+
+    m = m->eval(env, ctx);
+    auto mm = m->as_map();
+    if (!mm) throw error_t("eval_dissoc: argument #1 is not map");
+
+    key = seq_to_list(key->eval(env, ctx), ctx);
+    return map((*mm)->map.dissoc(key));
+  }
+
+  // (get map key [default]), nil when there is no key and no default.
+  object_sptr_t object_t::eval_get(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto m = p.first;
+    p = p.second->decompose();
+    auto key = p.first;
+    auto def = nil();
+    if (!p.second->as_nil()) {
+      p = p.second->decompose();
+      def = p.first;
+      if (!p.second->as_nil()) throw error_t("eval_get: unexpected '" + p.second->show(print_brief) + "'");
+    }
+
+    m = m->eval(env, ctx);
+    auto mm = m->as_map();
+    if (!mm) throw error_t("eval_get: argument #1 is not map");
+
+    key = seq_to_list(key->eval(env, ctx), ctx);
+    if (auto val = (*mm)->map.find(key)) return *val;
+    return def->eval(env, ctx);
+  }
+
+  // (contains map key)
+  object_sptr_t object_t::eval_contains(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto m = p.first;
+    p = p.second->decompose();
+    auto key = p.first;
+    if (!p.second->as_nil()) throw error_t("eval_contains: unexpected '" + p.second->show(print_brief) + "'");
+
+    m = m->eval(env, ctx);
+    auto mm = m->as_map();
+    if (!mm) throw error_t("eval_contains: argument #1 is not map");
+
+    key = seq_to_list(key->eval(env, ctx), ctx);
+    return atom((*mm)->map.find(key) != nullptr);
+  }
+
+  object_sptr_t object_t::eval_size(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto m = p.first;
+    if (!p.second->as_nil()) throw error_t("eval_size: unexpected '" + p.second->show(print_brief) + "'");
+
+    m = m->eval(env, ctx);
+    if (auto vv = m->as_vec()) return atom(static_cast<int64_t>((*vv)->size()));
+    auto mm = m->as_map();
+    if (!mm) throw error_t("eval_size: argument #1 is not map or vec");
+
+    return atom(static_cast<int64_t>((*mm)->map.size()));
+  }
+
+  object_sptr_t object_t::eval_entries(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto m = p.first;
+    if (!p.second->as_nil()) throw error_t("eval_entries: unexpected '" + p.second->show(print_brief) + "'");
+
+    m = m->eval(env, ctx);
+    auto mm = m->as_map();
+    if (!mm) throw error_t("eval_entries: argument #1 is not map");
+
+    return map_entries((*mm)->map, ctx);
+  }
+
+  // (to_map pairs), pairs is a list or seq of (key value) lists. Built with a
+  // transient, later pairs replace earlier ones.
+  object_sptr_t object_t::eval_to_map(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto l = p.first;
+    if (!p.second->as_nil()) throw error_t("eval_to_map: unexpected '" + p.second->show(print_brief) + "'");
+
+    auto [cursor, stages] = seq_view(l->eval(env, ctx), "eval_to_map", ctx);
+    hamt_map_t::transient_t transient;
+    object_sptr_t pair;
+    while (seq_next(cursor, stages, pair, ctx)) {
+      pair = seq_to_list(pair, ctx);
+      auto kv = pair->as_list();
+      auto v = kv ? (*kv)->tail->as_list() : nullptr;
+      if (!v) throw error_t("eval_to_map: '" + pair->show(print_brief) + "' is not (key value)");
+      transient.assoc(seq_to_list((*kv)->head, ctx), (*v)->head);
+    }
+    return map(transient.persistent());
+  }
+
+  namespace {
+
+    const char* packed_op_name(packed_op_t op) {
+      static const char* names[] = { "add", "sub", "mul", "less", "equal", "greater", "sum", "min", "max" };
+      return names[static_cast<size_t>(op)];
+    }
+
+    bool is_number(const object_t::variant_t& x) {
+      return std::get_if<int64_t>(&x) || std::get_if<double>(&x);
+    }
+
+    bool has_doubles(const object_t::variant_t& x) {
+      if (std::get_if<double>(&x)) return true;
+      auto v = std::get_if<object_t::object_vec_sptr_t>(&x);
+      return v && std::get_if<packed_array_t<double>>(&(*v)->values);
+    }
+
+    // Operand of a bulk kernel as 'size' values of T: a vec of T as is, a vec
+    // of the other type converted into 'tmp', a number repeated in 'tmp'.
+    template <typename T>
+    const T* vec_operand(const object_t::variant_t& x, size_t size, packed_array_t<T>& tmp) {
+      if (auto v = std::get_if<object_t::object_vec_sptr_t>(&x)) {
+        if (auto same = std::get_if<packed_array_t<T>>(&(*v)->values)) return same->data();
+        tmp = packed_array_t<T>(size);
+        std::visit([&tmp] (const auto& values) {
+          for (size_t i = 0; i < values.size(); i++) {
+            tmp[i] = static_cast<T>(values[i]);
+          }
+        }, (*v)->values);
+        return tmp.data();
+      }
+      T value = 0;
+      if (auto i = std::get_if<int64_t>(&x)) value = static_cast<T>(*i);
+      if (auto d = std::get_if<double>(&x)) value = static_cast<T>(*d);
+      tmp = packed_array_t<T>(size);
+      std::fill_n(tmp.data(), size, value);
+      return tmp.data();
+    }
+
+  }
+
+  // (vec l), l is a list or seq of numbers. Ints give an int vec, any double a double vec.
+  object_sptr_t object_t::eval_vec(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto l = p.first;
+    if (!p.second->as_nil()) throw error_t("eval_vec: unexpected '" + p.second->show(print_brief) + "'");
+
+    l = l->eval(env, ctx);
+    if (l->as_vec()) return l;
+
+    auto [cursor, stages] = seq_view(std::move(l), "eval_vec", ctx);
+    if (!cursor.source && !stages) {
+      packed_array_t<int64_t> values(std::max<int64_t>(cursor.to - cursor.from, 0));
+      for (size_t i = 0; i < values.size(); i++) {
+        values[i] = cursor.from + static_cast<int64_t>(i);
+      }
+      return vec(std::move(values));
+    }
+
+    std::vector<int64_t> ints;
+    std::vector<double> doubles;
+    object_sptr_t value;
+    while (seq_next(cursor, stages, value, ctx)) {
+      if (auto i = std::get_if<int64_t>(&value->value)) {
+        if (doubles.empty()) {
+          ints.push_back(*i);
+        } else {
+          doubles.push_back(*i);
+        }
+      } else if (auto d = std::get_if<double>(&value->value)) {
+        if (doubles.empty()) doubles.assign(ints.begin(), ints.end());
+        doubles.push_back(*d);
+      } else {
+        throw error_t("eval_vec: element '" + value->show(print_brief) + "' is not number");
+      }
+    }
+
+    if (doubles.empty()) {
+      packed_array_t<int64_t> values(ints.size());
+      std::copy(ints.begin(), ints.end(), values.data());
+      return vec(std::move(values));
+    }
+    packed_array_t<double> values(doubles.size());
+    std::copy(doubles.begin(), doubles.end(), values.data());
+    return vec(std::move(values));
+  }
+
+  object_sptr_t object_t::eval_vec_list(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto v = p.first;
+    if (!p.second->as_nil()) throw error_t("eval_vec_list: unexpected '" + p.second->show(print_brief) + "'");
+
+    v = v->eval(env, ctx);
+    auto vv = v->as_vec();
+    if (!vv) throw error_t("eval_vec_list: argument #1 is not vec");
+
+    auto ret = nil();
+    std::visit([&ret, &ctx] (const auto& values) {
+      for (size_t i = values.size(); i-- > 0; ) {
+        ret = list(atom(values[i]), ret, ctx);
+      }
+    }, (*vv)->values);
+    return ret;
+  }
+
+  // (vec_add x y), also sub, mul and the comparisons less, equal, greater
+  // that give masks. One argument may be a number, it is applied to every
+  // element. Ints are converted to doubles when the other argument has doubles.
+  object_sptr_t object_t::eval_vec_zip(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx, packed_op_t op) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto fn = "eval_vec_"s + packed_op_name(op);
+    auto p = t->decompose();
+    auto x = p.first;
+    p = p.second->decompose();
+    auto y = p.first;
+    if (!p.second->as_nil()) throw error_t(fn + ": unexpected '" + p.second->show(print_brief) + "'");
+
+    x = x->eval(env, ctx);
+    auto vx = x->as_vec();
+    if (!vx && !is_number(x->value)) throw error_t(fn + ": argument #1 is not vec or number");
+
+    y = y->eval(env, ctx);
+    auto vy = y->as_vec();
+    if (!vy && !is_number(y->value)) throw error_t(fn + ": argument #2 is not vec or number");
+
+    if (!vx && !vy) throw error_t(fn + ": no vec argument");
+    if (vx && vy && (*vx)->size() != (*vy)->size()) throw error_t(fn + ": vecs have different sizes");
+    size_t size = vx ? (*vx)->size() : (*vy)->size();
+    bool compare = op == packed_op_t::less || op == packed_op_t::equal || op == packed_op_t::greater;
+
+    auto run = [&] (auto zero) {
+      using T = decltype(zero);
+      packed_array_t<T> tx, ty;
+      auto px = vec_operand(x->value, size, tx);
+      auto py = vec_operand(y->value, size, ty);
+      if (compare) {
+        packed_array_t<int64_t> mask(size);
+        packed_compare(op, mask.data(), px, py, size);
+        return vec(std::move(mask));
+      }
+      packed_array_t<T> out(size);
+      packed_zip(op, out.data(), px, py, size);
+      return vec(std::move(out));
+    };
+    return has_doubles(x->value) || has_doubles(y->value) ? run(0.0) : run(int64_t(0));
+  }
+
+  // (vec_sum v), also min and max. The sum of an empty vec is 0.
+  object_sptr_t object_t::eval_vec_reduce(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx, packed_op_t op) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto fn = "eval_vec_"s + packed_op_name(op);
+    auto p = t->decompose();
+    auto v = p.first;
+    if (!p.second->as_nil()) throw error_t(fn + ": unexpected '" + p.second->show(print_brief) + "'");
+
+    v = v->eval(env, ctx);
+    auto vv = v->as_vec();
+    if (!vv) throw error_t(fn + ": argument #1 is not vec");
+    if (op != packed_op_t::sum && !(*vv)->size()) throw error_t(fn + ": vec is empty");
+
+    return std::visit([op] (const auto& values) {
+      return atom(packed_reduce(op, values.data(), values.size()));
+    }, (*vv)->values);
+  }
+
+  object_sptr_t object_t::eval_vec_dot(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto x = p.first;
+    p = p.second->decompose();
+    auto y = p.first;
+    if (!p.second->as_nil()) throw error_t("eval_vec_dot: unexpected '" + p.second->show(print_brief) + "'");
+
+    x = x->eval(env, ctx);
+    auto vx = x->as_vec();
+    if (!vx) throw error_t("eval_vec_dot: argument #1 is not vec");
+
+    y = y->eval(env, ctx);
+    auto vy = y->as_vec();
+    if (!vy) throw error_t("eval_vec_dot: argument #2 is not vec");
+
+    size_t size = (*vx)->size();
+    if ((*vy)->size() != size) throw error_t("eval_vec_dot: vecs have different sizes");
+
+    auto run = [&] (auto zero) {
+      using T = decltype(zero);
+      packed_array_t<T> tx, ty;
+      return atom(packed_dot(vec_operand(x->value, size, tx), vec_operand(y->value, size, ty), size));
+    };
+    return has_doubles(x->value) || has_doubles(y->value) ? run(0.0) : run(int64_t(0));
+  }
+
+  // (vec_select v mask), elements of v where the int vec mask is not 0.
+  object_sptr_t object_t::eval_vec_select(object_sptr_t, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    auto p = t->decompose();
+    auto v = p.first;
+    p = p.second->decompose();
+    auto m = p.first;
+    if (!p.second->as_nil()) throw error_t("eval_vec_select: unexpected '" + p.second->show(print_brief) + "'");
+
+    v = v->eval(env, ctx);
+    auto vv = v->as_vec();
+    if (!vv) throw error_t("eval_vec_select: argument #1 is not vec");
+
+    m = m->eval(env, ctx);
+    auto vm = m->as_vec();
+    auto mask = vm ? std::get_if<packed_array_t<int64_t>>(&(*vm)->values) : nullptr;
+    if (!mask) throw error_t("eval_vec_select: argument #2 is not int vec");
+    if (mask->size() != (*vv)->size()) throw error_t("eval_vec_select: vecs have different sizes");
+
+    return std::visit([mask] (const auto& values) {
+      using array_t = std::decay_t<decltype(values)>;
+      array_t out(values.size());
+      out.truncate(packed_select(out.data(), values.data(), mask->data(), values.size()));
+      return vec(std::move(out));
+    }, (*vv)->values);
+  }
+
+  object_sptr_t object_t::eval_call_lambda(object_sptr_t h, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    DEBUG_LOGGER_LISP("h", h);
+    DEBUG_LOGGER_LISP("t", t);
+    DEBUG_LOGGER_LISP("env", env.get());
+
+    auto lambda = h->as_lambda();
+    if (!lambda) throw error_t("eval_call_lambda: argument #0 is not lambda");
+
+    profiler_t::scope_t profile(ctx.profiler, (*lambda)->body,
+        [lambda] { return profile_name(*lambda, "lambda"); }, ctx.metrics.eval_calls);
+
+    auto env_lambda = std::make_shared<env_t>((*lambda)->env);
+    ctx.metrics.env_frames++;
+
+    DEBUG_LOGGER_LISP("env_lambda_origin", (*lambda)->env.get());
+    DEBUG_LOGGER_LISP("env_lambda", env_lambda.get());
+    DEBUG_LOGGER_LISP("args", (*lambda)->args);
+    DEBUG_LOGGER_LISP("body", (*lambda)->body);
+
+    (*lambda)->args->for_each([&t, &env, &env_lambda, &ctx](object_sptr_t object) -> bool {
+      auto p = t->decompose();
+      t = p.second;
+      auto arg = object->cons(p.first->cons(nil()));
+      auto val = eval_def(nil(), arg, env, env_lambda, ctx);
+      DEBUG_LOGGER_LISP("arg", arg);
+      DEBUG_LOGGER_LISP("val", val);
+      return true;
+    });
+
+    auto ret = (*lambda)->body->eval(env_lambda, ctx);
+    DEBUG_LOGGER_LISP("ret", ret);
+    return ret;
+  }
+
+  object_sptr_t object_t::apply_lambda(object_sptr_t h, std::initializer_list<object_sptr_t> args, context_t& ctx, env_sptr_t env) {
+    DEBUG_LOGGER_TRACE_LISP;
+    DEBUG_LOGGER_LISP("h", h);
+
+    if (h->as_macro()) {
+      if (!env) throw error_t("apply_lambda: macro without env");
+      auto t = nil();
+      for (auto it = std::rbegin(args); it != std::rend(args); ++it) {
+        t = list(list(ident("__kernel_quote"), list(*it, nil())), t);
+      }
+      return eval_call_macro(h, t, env, ctx);
+    }
+
+    if (auto native = h->as_native()) {
+      if (args.size() > object_native_t::args_max) throw error_t((*native)->name + ": too many arguments");
+      return (*native)->function(args.begin(), args.size(), ctx);
+    }
+
+    auto lambda = h->as_lambda();
+    if (!lambda) throw error_t("apply_lambda: argument #0 is not function");
+
+    profiler_t::scope_t profile(ctx.profiler, (*lambda)->body,
+        [lambda] { return profile_name(*lambda, "lambda"); }, ctx.metrics.eval_calls);
+
+    auto env_lambda = std::make_shared<env_t>((*lambda)->env);
+    ctx.metrics.env_frames++;
+
+    auto arg = args.begin();
+    (*lambda)->args->for_each([&arg, &args, &env_lambda](object_sptr_t object) -> bool {
+      auto name = object->as_ident();
+      if (!name) throw error_t("apply_lambda: argument name is not ident");
+      if (arg == args.end()) throw error_t("apply_lambda: too few arguments");
+      env_lambda->defvar((*name)->value, *arg++);
+      return true;
+    });
+
+    auto ret = (*lambda)->body->eval(env_lambda, ctx);
+    DEBUG_LOGGER_LISP("ret", ret);
+    return ret;
+  }
+
+  object_sptr_t object_t::eval_call_macro(object_sptr_t h, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+
+    auto macro = h->as_macro();
+    if (!macro) throw error_t("eval_call_macro: argument #0 is not macro");
+
+    profiler_t::scope_t profile(ctx.profiler, (*macro)->body,
+        [macro] { return profile_name(*macro, "macro"); }, ctx.metrics.eval_calls);
+
+    auto env_macro = std::make_shared<env_t>();
+    ctx.metrics.env_frames++;
+    ctx.metrics.macro_expansions++;
+
+    (*macro)->args->for_each([&t, &env, &env_macro, &ctx] (object_sptr_t object) -> bool {
+      auto p = t->decompose();
+      t = p.second;
+      auto arg = object->cons(p.first->cons(nil()));
+      auto val = eval_def(nil(), arg, env, env_macro, ctx, false);
+      return true;
+    });
 
     auto macroexpand = [](object_sptr_t object, env_sptr_t env, auto f) -> object_sptr_t {
       auto ret = object;
       std::visit(overloaded {
         [&ret, env] (object_ident_sptr_t v) {
-          try {
-            ret = env->getvar(v->value);
-          } catch (const error_t&) {
-            ;
-          }
+          if (auto val = env->findvar(v->value)) ret = *val;
         },
         [&ret, object, env, f] (object_list_sptr_t) {
           auto ret_local = nil();
@@ -393,23 +1940,46 @@ namespace lisp_interpreter {
     return ret->eval(env, ctx);
   }
 
+  object_sptr_t object_t::eval_call_native(object_sptr_t h, object_sptr_t t, env_sptr_t env, context_t& ctx) {
+    DEBUG_LOGGER_TRACE_LISP;
+    DEBUG_LOGGER_LISP("h", h);
+    DEBUG_LOGGER_LISP("t", t);
+
+    auto native = h->as_native();
+    if (!native) throw error_t("eval_call_native: argument #0 is not native");
+
+    object_sptr_t args[object_native_t::args_max];
+    size_t count = 0;
+    t->for_each([&args, &count, &native, &env, &ctx](object_sptr_t object) -> bool {
+      if (count == object_native_t::args_max) throw error_t((*native)->name + ": too many arguments");
+      args[count++] = object->eval(env, ctx);
+      return true;
+    });
+
+    auto ret = (*native)->function(args, count, ctx);
+    DEBUG_LOGGER_LISP("ret", ret);
+    return ret;
+  }
+
   object_sptr_t object_t::eval_call(object_sptr_t h, object_sptr_t t, env_sptr_t env, context_t& ctx) {
     DEBUG_LOGGER_TRACE_LISP;
-    DEBUG_LOGGER_LISP("h: %s", h->show().c_str());
-    DEBUG_LOGGER_LISP("t: %s", t->show().c_str());
-    DEBUG_LOGGER_LISP("env: %p", env.get());
+    DEBUG_LOGGER_LISP("h", h);
+    DEBUG_LOGGER_LISP("t", t);
+    DEBUG_LOGGER_LISP("env", env.get());
 
     auto name = h->as_ident();
     if (!name) throw error_t("eval_call: argument #0 is not ident");
 
-    auto obj = env->getvar((*name)->value);
+    auto obj = lookup(env, (*name)->value, ctx);
     // obj = obj->eval(env, ctx);
-    DEBUG_LOGGER_LISP("obj: %s", obj->show().c_str());
+    DEBUG_LOGGER_LISP("obj", obj);
 
     if (obj->as_lambda()) {
       return eval_call_lambda(obj, t, env, ctx);
     } else if (obj->as_macro()){
       return eval_call_macro(obj, t, env, ctx);
+    } else if (obj->as_native()) {
+      return eval_call_native(obj, t, env, ctx);
     }
 
     return obj;
@@ -417,9 +1987,9 @@ namespace lisp_interpreter {
 
   object_sptr_t object_t::eval_list(object_sptr_t h, object_sptr_t t, env_sptr_t env, context_t& ctx) {
     DEBUG_LOGGER_TRACE_LISP;
-    DEBUG_LOGGER_LISP("h: %s", h->show().c_str());
-    DEBUG_LOGGER_LISP("t: %s", t->show().c_str());
-    DEBUG_LOGGER_LISP("env: %p", env.get());
+    DEBUG_LOGGER_LISP("h", h);
+    DEBUG_LOGGER_LISP("t", t);
+    DEBUG_LOGGER_LISP("env", env.get());
     auto ret = nil();
     std::visit(overloaded {
       [&ret, h, t, env, &ctx] (object_ident_sptr_t v) {
@@ -449,6 +2019,86 @@ namespace lisp_interpreter {
           ret = eval_typeof(h, t, env, ctx);
         } else if (v->value == "__kernel_load") {
           ret = eval_load(h, t, env, ctx);
+        } else if (v->value == "__kernel_load_data") {
+          ret = eval_load_data(h, t, env, ctx);
+        } else if (v->value == "__kernel_open") {
+          ret = eval_open(h, t, env, ctx);
+        } else if (v->value == "__kernel_close") {
+          ret = eval_close(h, t, env, ctx);
+        } else if (v->value == "__kernel_read_line") {
+          ret = eval_read_line(h, t, env, ctx);
+        } else if (v->value == "__kernel_fold_lines") {
+          ret = eval_fold_lines(h, t, env, ctx);
+        } else if (v->value == "__kernel_write") {
+          ret = eval_write(h, t, env, ctx, false);
+        } else if (v->value == "__kernel_write_line") {
+          ret = eval_write(h, t, env, ctx, true);
+        } else if (v->value == "__kernel_range") {
+          ret = eval_range(h, t, env, ctx);
+        } else if (v->value == "__kernel_map") {
+          ret = eval_stage(h, t, env, ctx, false);
+        } else if (v->value == "__kernel_filter") {
+          ret = eval_stage(h, t, env, ctx, true);
+        } else if (v->value == "__kernel_foldl") {
+          ret = eval_foldl(h, t, env, ctx);
+        } else if (v->value == "__kernel_hash") {
+          ret = eval_hash(h, t, env, ctx);
+        } else if (v->value == "__kernel_hash_consing") {
+          ret = eval_hash_consing(h, t, env, ctx);
+        } else if (v->value == "__kernel_lazy_defs") {
+          ret = eval_lazy_defs(h, t, env, ctx);
+        } else if (v->value == "__kernel_assoc") {
+          ret = eval_assoc(h, t, env, ctx);
+        } else if (v->value == "__kernel_dissoc") {
+          ret = eval_dissoc(h, t, env, ctx);
+        } else if (v->value == "__kernel_get") {
+          ret = eval_get(h, t, env, ctx);
+        } else if (v->value == "__kernel_contains") {
+          ret = eval_contains(h, t, env, ctx);
+        } else if (v->value == "__kernel_size") {
+          ret = eval_size(h, t, env, ctx);
+        } else if (v->value == "__kernel_entries") {
+          ret = eval_entries(h, t, env, ctx);
+        } else if (v->value == "__kernel_to_map") {
+          ret = eval_to_map(h, t, env, ctx);
+        } else if (v->value == "__kernel_substring") {
+          ret = eval_substring(h, t, env, ctx);
+        } else if (v->value == "__kernel_string_length") {
+          ret = eval_string_length(h, t, env, ctx);
+        } else if (v->value == "__kernel_string_find") {
+          ret = eval_string_find(h, t, env, ctx);
+        } else if (v->value == "__kernel_string_count") {
+          ret = eval_string_count(h, t, env, ctx);
+        } else if (v->value == "__kernel_string_split") {
+          ret = eval_string_split(h, t, env, ctx);
+        } else if (v->value == "__kernel_string_replace") {
+          ret = eval_string_replace(h, t, env, ctx);
+        } else if (v->value == "__kernel_vec") {
+          ret = eval_vec(h, t, env, ctx);
+        } else if (v->value == "__kernel_vec_list") {
+          ret = eval_vec_list(h, t, env, ctx);
+        } else if (v->value == "__kernel_vec_add") {
+          ret = eval_vec_zip(h, t, env, ctx, packed_op_t::add);
+        } else if (v->value == "__kernel_vec_sub") {
+          ret = eval_vec_zip(h, t, env, ctx, packed_op_t::sub);
+        } else if (v->value == "__kernel_vec_mul") {
+          ret = eval_vec_zip(h, t, env, ctx, packed_op_t::mul);
+        } else if (v->value == "__kernel_vec_less") {
+          ret = eval_vec_zip(h, t, env, ctx, packed_op_t::less);
+        } else if (v->value == "__kernel_vec_equal") {
+          ret = eval_vec_zip(h, t, env, ctx, packed_op_t::equal);
+        } else if (v->value == "__kernel_vec_greater") {
+          ret = eval_vec_zip(h, t, env, ctx, packed_op_t::greater);
+        } else if (v->value == "__kernel_vec_sum") {
+          ret = eval_vec_reduce(h, t, env, ctx, packed_op_t::sum);
+        } else if (v->value == "__kernel_vec_min") {
+          ret = eval_vec_reduce(h, t, env, ctx, packed_op_t::min);
+        } else if (v->value == "__kernel_vec_max") {
+          ret = eval_vec_reduce(h, t, env, ctx, packed_op_t::max);
+        } else if (v->value == "__kernel_vec_dot") {
+          ret = eval_vec_dot(h, t, env, ctx);
+        } else if (v->value == "__kernel_vec_select") {
+          ret = eval_vec_select(h, t, env, ctx);
         } else if (v->value == "__kernel_def") {
           ret = eval_def(h, t, env, env, ctx);
         } else if (v->value == "__kernel_lambda") {
@@ -467,32 +2117,41 @@ namespace lisp_interpreter {
       [&ret, h, t, env, &ctx] (object_macro_sptr_t) {
         ret = eval_call_macro(h, t, env, ctx);
       },
+      [&ret, h, t, env, &ctx] (object_native_sptr_t) {
+        ret = eval_call_native(h, t, env, ctx);
+      },
       [&ret, h, t, env, &ctx] (auto) {
-        DEBUG_LOGGER_LISP("h: %s", h->show().c_str());
-        DEBUG_LOGGER_LISP("t: %s", t->show().c_str());
-        DEBUG_LOGGER_LISP("env: %p", env.get());
+        DEBUG_LOGGER_LISP("h", h);
+        DEBUG_LOGGER_LISP("t", t);
+        DEBUG_LOGGER_LISP("env", env.get());
         ret = h->eval(env, ctx);
         if (!t->as_nil()) {
           ret = t->eval(env, ctx);
         }
-        DEBUG_LOGGER_LISP("ret: %s", ret->show().c_str());
+        DEBUG_LOGGER_LISP("ret", ret);
       }
     }, h->value);
-    DEBUG_LOGGER_LISP("ret: %s", ret->show().c_str());
+    DEBUG_LOGGER_LISP("ret", ret);
     return ret;
   }
 
   object_sptr_t object_t::eval(env_sptr_t env, context_t& ctx) const {
     DEBUG_LOGGER_TRACE_LISP;
-    DEBUG_LOGGER_LISP("self: %s", self()->show().c_str());
-    DEBUG_LOGGER_LISP("env: %p", env.get());
-    ctx.eval_calls++;
+    DEBUG_LOGGER_LISP("self", self());
+    DEBUG_LOGGER_LISP("env", env.get());
+    auto& metrics = ctx.metrics;
+    metrics.eval_calls++;
+    metrics.stack_level_max = std::max(metrics.stack_level_max, ++metrics.stack_level);
+    struct stack_level_guard_t {
+      uint64_t& level;
+      ~stack_level_guard_t() { level--; }
+    } stack_level_guard{metrics.stack_level};
     auto ret = nil();
     std::visit(overloaded {
       [&ret, env, &ctx] (object_ident_sptr_t v) {
-        DEBUG_LOGGER_LISP("eval: ident: %s", v->value.c_str());
+        DEBUG_LOGGER_LISP("ident", v.get());
         env->show();
-        ret = env->getvar(v->value);
+        ret = lookup(env, v->value, ctx);
         // ret = ret->eval(env, ctx);
       },
       [&ret, env, &ctx, this] (object_list_sptr_t) {
@@ -501,129 +2160,505 @@ namespace lisp_interpreter {
       },
       [&ret, this] (auto) {
         ret = self();
-        DEBUG_LOGGER_LISP("ret = self: %s", ret->show().c_str());
+        DEBUG_LOGGER_LISP("ret", ret);
       },
     }, value);
-    DEBUG_LOGGER_LISP("ret: %s", ret->show().c_str());
+    DEBUG_LOGGER_LISP("ret", ret);
     return ret;
   }
 
-  std::string object_t::show() const {
-    std::string str;
-    std::visit(overloaded {
-      [&str] (object_nil_sptr_t) {
-        str += "()";
-      },
-      [&str] (bool v) {
-        str += v ? "true" : "false";
-      },
-      [&str] (int64_t v) {
-        str += std::to_string(v);
-      },
-      [&str] (double v) {
-        str += std::to_string(v);
-      },
-      [&str] (object_string_sptr_t v) {
-        str += "\"" + v->value + "\"";
-      },
-      [&str] (object_ident_sptr_t v) {
-        str += v->value;
-      },
-      [&str] (object_lambda_sptr_t v) {
-        str += "(lambda " + v->args->show() + " " + v->body->show() + ")";
-      },
-      [&str] (object_macro_sptr_t v) {
-        str += "(macro " + v->args->show() + " " + v->body->show() + ")";
-      },
-      [&str, this] (object_list_sptr_t) {
-        str += '(';
-        bool is_first = true;
-        for_each([&str, &is_first] (object_sptr_t object) -> bool {
-          if (!is_first) {
-            str += " ";
+  // Forces the cells print shows within 'limits', and one more after 'length'
+  // cells, which tells whether " ..." follows. Lists and maps are walked, the
+  // seqs in them are forced in place.
+  void object_t::realize(context_t& ctx, print_limits_t limits) const {
+    std::vector<std::pair<const object_t*, size_t>> stack{{this, 0}}; // object and its depth
+    while (!stack.empty()) {
+      auto [object, depth] = stack.back();
+      stack.pop_back();
+      if (depth >= limits.depth) continue;
+
+      if (auto m = object->as_map()) {
+        size_t count = 0;
+        (*m)->map.for_each([&stack, &count, &limits, depth] (const object_sptr_t& key, const object_sptr_t& value) {
+          if (count++ >= limits.length) return;
+          stack.push_back({key.get(), depth + 1});
+          stack.push_back({value.get(), depth + 1});
+        });
+        continue;
+      }
+
+      for (size_t index = 0; object->as_list() || object->as_seq(); index++) {
+        const object_t* head;
+        if (auto seq = object->as_seq()) {
+          auto& forced = seq_force(**seq, ctx);
+          if (!forced.first) break;
+          head = forced.first.get();
+          object = forced.rest.get();
+        } else {
+          auto list = object->as_list();
+          head = (*list)->head.get();
+          object = (*list)->tail.get();
+        }
+        if (index >= limits.length) break;
+        stack.push_back({head, depth + 1});
+        if (!object->as_list() && !object->as_seq()) stack.push_back({object, depth + 1});
+      }
+    }
+  }
+
+  std::string object_t::show(print_limits_t limits) const {
+    memory_sink_t out;
+    print(out, limits);
+    return out.str();
+  }
+
+  namespace {
+
+    void print_number(output_sink_t& out, int64_t v) {
+      char buf[24];
+      auto res = std::to_chars(std::begin(buf), std::end(buf), v);
+      out.write(buf, res.ptr - buf);
+    }
+
+    void print_number(output_sink_t& out, double v) {
+      // Shortest representation that reads back to the same value, still a double.
+      char buf[32];
+      auto res = std::to_chars(std::begin(buf), std::end(buf) - 2, v);
+      if (std::find_if(buf, res.ptr, [](char c) { return c == '.' || c == 'e' || c == 'n'; }) == res.ptr) {
+        *res.ptr++ = '.';
+        *res.ptr++ = '0';
+      }
+      out.write(buf, res.ptr - buf);
+    }
+
+  }
+
+  void object_t::print(output_sink_t& out, print_limits_t limits) const {
+    // Explicit stack: 'rest' continues a list at the given cell, 'text' is written as is.
+    struct item_t {
+      enum kind_t { value, rest, text } kind;
+      const object_t*   object;
+      const char*       str;
+      size_t            depth;
+      size_t            index;
+    };
+
+    std::vector<item_t> stack;
+    stack.push_back({item_t::value, this, nullptr, 0, 0});
+
+    // Head and tail of a list cell or a forced, non-empty seq; nullptrs otherwise.
+    auto cell = [] (const object_t* object) -> std::pair<const object_t*, const object_t*> {
+      if (auto list = object->as_list()) return {(*list)->head.get(), (*list)->tail.get()};
+      auto seq = object->as_seq();
+      if (seq && (*seq)->forced && (*seq)->first) return {(*seq)->first.get(), (*seq)->rest.get()};
+      return {nullptr, nullptr};
+    };
+    auto empty = [] (const object_t* object) {
+      auto seq = object->as_seq();
+      return object->as_nil() || (seq && (*seq)->forced && !(*seq)->first);
+    };
+
+    while (!stack.empty()) {
+      auto item = stack.back();
+      stack.pop_back();
+
+      if (item.kind == item_t::text) {
+        out.write(item.str);
+        continue;
+      }
+
+      if (item.kind == item_t::rest) {
+        auto [head, tail] = cell(item.object);
+        if (!head && !empty(item.object)) {
+          out.write(" . ");
+          stack.push_back({item_t::text, nullptr, ")", 0, 0});
+          stack.push_back({item_t::value, item.object, nullptr, item.depth, 0});
+        } else if (!head) {
+          out.put(')');
+        } else if (item.index >= limits.length) {
+          out.write(" ...)");
+        } else {
+          if (item.index) out.put(' ');
+          stack.push_back({item_t::rest, tail, nullptr, item.depth, item.index + 1});
+          stack.push_back({item_t::value, head, nullptr, item.depth, 0});
+        }
+        continue;
+      }
+
+      auto function = [&stack, &item, &out] (const char* kind, const auto& v) {
+        out.put('(');
+        out.write(kind);
+        out.put(' ');
+        stack.push_back({item_t::text, nullptr, ")", 0, 0});
+        stack.push_back({item_t::value, v->body.get(), nullptr, item.depth + 1, 0});
+        stack.push_back({item_t::text, nullptr, " ", 0, 0});
+        stack.push_back({item_t::value, v->args.get(), nullptr, item.depth + 1, 0});
+      };
+
+      std::visit(overloaded {
+        [&out] (const object_nil_sptr_t&) {
+          out.write("()");
+        },
+        [&out] (bool v) {
+          out.write(v ? "true" : "false");
+        },
+        [&out] (int64_t v) {
+          print_number(out, v);
+        },
+        [&out] (double v) {
+          print_number(out, v);
+        },
+        [&out] (const object_string_sptr_t& v) {
+          out.put('"');
+          v->for_each_chunk([&out] (std::string_view chunk) { out.write(chunk); });
+          out.put('"');
+        },
+        [&out] (const object_ident_sptr_t& v) {
+          out.write(v->value);
+        },
+        [&function] (const object_lambda_sptr_t& v) {
+          function("lambda", v);
+        },
+        [&function] (const object_macro_sptr_t& v) {
+          function("macro", v);
+        },
+        [&out, &stack, &item, &limits] (const object_map_sptr_t& v) {
+          if (item.depth >= limits.depth) {
+            out.write("{...}");
+            return;
+          }
+          std::vector<std::pair<const object_t*, const object_t*>> entries;
+          v->map.for_each([&entries, &limits] (const object_sptr_t& key, const object_sptr_t& value) {
+            if (entries.size() <= limits.length) entries.push_back({key.get(), value.get()});
+          });
+          out.put('{');
+          stack.push_back({item_t::text, nullptr, entries.size() > limits.length ? " ...}" : "}", 0, 0});
+          if (entries.size() > limits.length) entries.pop_back();
+          for (size_t i = entries.size(); i-- > 0; ) {
+            stack.push_back({item_t::value, entries[i].second, nullptr, item.depth + 1, 0});
+            stack.push_back({item_t::text, nullptr, " ", 0, 0});
+            stack.push_back({item_t::value, entries[i].first, nullptr, item.depth + 1, 0});
+            if (i) stack.push_back({item_t::text, nullptr, ", ", 0, 0});
+          }
+        },
+        [&out] (const object_native_sptr_t& v) {
+          out.write("#<native ");
+          out.write(v->name);
+          out.put('>');
+        },
+        [&out, &limits] (const object_vec_sptr_t& v) {
+          out.put('[');
+          std::visit([&out, &limits] (const auto& values) {
+            for (size_t i = 0; i < values.size(); i++) {
+              if (i) out.put(' ');
+              if (i >= limits.length) {
+                out.write("...");
+                break;
+              }
+              print_number(out, values[i]);
+            }
+          }, v->values);
+          out.put(']');
+        },
+        [&out, &stack, &item, &limits] (const object_seq_sptr_t& v) {
+          if (!v->forced) {
+            out.write("#<seq>");
+          } else if (!v->first) {
+            out.write("()");
+          } else if (item.depth >= limits.depth) {
+            out.write("(...)");
           } else {
-            is_first = false;
+            out.put('(');
+            stack.push_back({item_t::rest, item.object, nullptr, item.depth + 1, 0});
           }
-          str += object->show();
-          return true;
-        });
-        str += ')';
-      },
-      [&str] (auto) {
-        str += "UNK";
+        },
+        [&out] (const object_thunk_sptr_t& v) {
+          out.write("#<lazy ");
+          out.write(v->name);
+          out.put('>');
+        },
+        [&out] (const object_file_sptr_t& v) {
+          out.write("#<file ");
+          out.write(v->path);
+          out.put('>');
+        },
+        [&out, &stack, &item, &limits] (const object_list_sptr_t&) {
+          if (item.depth >= limits.depth) {
+            out.write("(...)");
+            return;
+          }
+          out.put('(');
+          stack.push_back({item_t::rest, item.object, nullptr, item.depth + 1, 0});
+        },
+        [&out] (const auto&) {
+          out.write("UNK");
+        }
+      }, item.object->value);
+    }
+  }
+
+  object_sptr_t object_t::parse(std::string_view str) {
+    DEBUG_LOGGER_TRACE_LISP;
+    parser_t parser;
+    parser.feed(str);
+    auto ret = parser.finish();
+    if (ret->as_list() && ret->tail()->as_nil()) ret = ret->head(); // XXX
+    return ret;
+  }
+
+  object_sptr_t object_t::parse_file(const std::string& path) {
+    DEBUG_LOGGER_TRACE_LISP;
+    mapped_file_t file(path);
+    if (!file.is_open()) throw error_t("parse_file: file '" + path + "' is not readable");
+
+    parser_t parser({source_loc_t::intern(path), 1, 1});
+    parser.feed(file.view());
+    return parser.finish();
+  }
+
+  namespace {
+    bool is_digit_char(char c) {
+      return std::isdigit(static_cast<unsigned char>(c));
+    }
+
+    // Printable ASCII but brackets and quotes; digits and '.'.
+    constexpr byte_class_t ident_class  = {'!', '~', {'(', ')', '"'}};
+    constexpr byte_class_t number_class = {'.', '9', {'/', '/', '/'}};
+
+    char to_lower(char c) {
+      return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+
+    bool equal_icase(std::string_view x, std::string_view y) {
+      return x.size() == y.size() && std::equal(x.begin(), x.end(), y.begin(),
+          [](char a, char b) { return to_lower(a) == b; });
+    }
+  }
+
+  parser_t::parser_t(source_loc_t start)
+    : file(start.file), state(state_t::none), token_loc(start), offset(start.column - 1), line(start.line), line_start(0) {
+    stack.push_back({object_t::nil(), nullptr, start});
+  }
+
+  source_loc_t parser_t::loc() const {
+    return {file, static_cast<uint32_t>(line), static_cast<uint32_t>(offset - line_start + 1)};
+  }
+
+  void parser_t::advance(std::string_view text) {
+    for (size_t i = 0; (i = scan_find(text.data() + i, text.size() - i, '\n') + i) < text.size(); i++) {
+      line++;
+      line_start = offset + i + 1;
+    }
+    offset += text.size();
+  }
+
+  void parser_t::push(object_sptr_t object, source_loc_t loc) {
+    auto& frame = stack.back();
+    auto cell = std::make_shared<object_t::object_list_t>(object, object_t::nil(), loc);
+    auto list = std::make_shared<object_t>(object_t::object_list_sptr_t(cell));
+    if (frame.last) {
+      frame.last->tail = list;
+    } else {
+      frame.head = list;
+    }
+    frame.last = cell;
+  }
+
+  void parser_t::open_list() {
+    stack.push_back({object_t::nil(), nullptr, loc()});
+  }
+
+  void parser_t::close_list() {
+    if (stack.size() == 1) throw error_t("parse: unexpected ')' at " + loc().show());
+    auto frame = stack.back();
+    stack.pop_back();
+    push(frame.head, frame.loc);
+  }
+
+  void parser_t::emit_atom(state_t kind, std::string_view token) {
+    if (kind == state_t::string) {
+      push(object_t::string(std::string(token)), token_loc);
+    } else if (kind == state_t::number) {
+      // The whole token is read, '1.2.3' is not 1.2.
+      auto number = [this, token](auto value) {
+        auto last = token.data() + token.size();
+        auto res = std::from_chars(token.data(), last, value);
+        if (res.ec != std::errc() || res.ptr != last)
+          throw error_t("parse: invalid number '" + std::string(token) + "' at " + token_loc.show());
+        push(object_t::atom(value), token_loc);
+      };
+      if (token.find('.') == std::string_view::npos) {
+        number(int64_t(0));
+      } else {
+        number(0.0);
       }
-    }, value);
-    return str;
+    } else if (equal_icase(token, "true")) {
+      push(object_t::atom(true), token_loc);
+    } else if (equal_icase(token, "false")) {
+      push(object_t::atom(false), token_loc);
+    } else {
+      std::string value(token.size(), '\0');
+      std::transform(token.begin(), token.end(), value.begin(), to_lower);
+      push(object_t::ident(std::move(value)), token_loc);
+    }
   }
 
-  object_sptr_t object_t::parse(const std::string& str) {
+  void parser_t::feed(std::string_view chunk) {
     DEBUG_LOGGER_TRACE_LISP;
-    std::stack<object_sptr_t> stack;
-    auto it = str.begin();
-    auto ite = str.end();
-    stack.emplace(nil());
+    auto it = chunk.begin();
+    auto ite = chunk.end();
+    auto consume = [this, &it](std::string_view::iterator to) {
+      advance({it, to});
+      it = to;
+    };
+    auto token = [this, &it](std::string_view::iterator to) -> std::string_view {
+      if (pending.empty()) return {it, to};
+      pending.append(it, to);
+      return pending;
+    };
+    auto find = [ite](std::string_view::iterator from, char c) {
+      return from + scan_find(std::to_address(from), ite - from, c);
+    };
+    auto class_end = [ite](std::string_view::iterator from, const byte_class_t& cls) {
+      return from + scan_class_end(std::to_address(from), ite - from, cls);
+    };
 
     while (it != ite) {
-      if (*it == '(') {
-        it++;
-        stack.emplace(nil());
-      } else if (*it == ';') {
-        it = std::find(it, ite, '\n');
-      } else if (*it == ')') {
-        it++;
-        if (stack.empty()) throw error_t("unexpected ')' on pos " + std::to_string(ite - it));
-
-        auto l = stack.top();
-        stack.pop();
-
-        if (stack.empty()) throw error_t("unexpected ')' on pos " + std::to_string(ite - it));
-
-        stack.top() = l->cons(stack.top());
-      } else if (*it == '-' && std::isdigit(*it)) {
-        ;
-      } else if (std::isdigit(*it) || (*it == '-' && it != ite && isdigit(*(it + 1)))) {
-        auto it_origin = it;
-        it = std::find_if_not(it + 1, ite, [](auto c){
-            return std::isdigit(c) || c == '.'; });
-
-        if (std::find(it_origin, it, '.') == it) { // int64_t
-          int64_t value = stol(std::string(it_origin, it));
-          stack.top() = atom(value)->cons(stack.top());
-        } else { // double
-          double value = stod(std::string(it_origin, it));
-          stack.top() = atom(value)->cons(stack.top());
+      switch (state) {
+        case state_t::none: {
+          char c = *it;
+          if (c == '(') {
+            open_list();
+            consume(it + 1);
+          } else if (c == ')') {
+            close_list();
+            consume(it + 1);
+          } else if (c == ';') {
+            state = state_t::comment;
+          } else if (c == '"') {
+            token_loc = loc();
+            state = state_t::string;
+            consume(it + 1);
+          } else if (is_digit_char(c)) {
+            token_loc = loc();
+            state = state_t::number;
+          } else if (c == '-') {
+            token_loc = loc();
+            if (it + 1 == ite) {
+              pending = "-";
+              consume(ite);
+              state = state_t::minus;
+            } else {
+              state = is_digit_char(*(it + 1)) ? state_t::number : state_t::ident;
+            }
+          } else if (std::isgraph(static_cast<unsigned char>(c))) {
+            token_loc = loc();
+            state = state_t::ident;
+          } else {
+            consume(it + 1);
+          }
+          break;
         }
-      } else if (*it == '"') {
-        auto it_origin = it;
-        it = std::find(it + 1, ite, '"');
-        if (it != ite) ++it;
-
-        auto value = std::string(it_origin + 1, it - 1);
-        stack.top() = string(value)->cons(stack.top());
-      } else if (std::isgraph(*it)) {
-        auto it_origin = it;
-        it = std::find_if_not(it, ite, [](auto c){
-            return std::isgraph(c) && c != '(' && c != ')' && c != '"'; });
-
-        auto value = std::string(it_origin, it);
-        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
-        if (value == "true") {
-          stack.top() = atom(true)->cons(stack.top());
-        } else if (value == "false") {
-          stack.top() = atom(false)->cons(stack.top());
-        } else {
-          stack.top() = ident(value)->cons(stack.top());
+        case state_t::minus: {
+          state = is_digit_char(*it) ? state_t::number : state_t::ident;
+          break;
+        }
+        case state_t::comment: {
+          auto to = find(it, '\n');
+          consume(to);
+          if (to != ite) state = state_t::none;
+          break;
+        }
+        case state_t::string: {
+          auto to = find(it, '"');
+          if (to == ite) {
+            pending.append(it, ite);
+            consume(ite);
+            break;
+          }
+          emit_atom(state, token(to));
+          pending.clear();
+          consume(to + 1);
+          state = state_t::none;
+          break;
+        }
+        case state_t::number:
+        case state_t::ident: {
+          auto from = (pending.empty() && *it == '-') ? it + 1 : it;
+          auto to = class_end(from, state == state_t::number ? number_class : ident_class);
+          if (to == ite) {
+            pending.append(it, ite);
+            consume(ite);
+            break;
+          }
+          emit_atom(state, token(to));
+          pending.clear();
+          consume(to);
+          state = state_t::none;
+          break;
         }
-      } else {
-        it++;
       }
     }
+  }
 
-    if (stack.size() != 1) throw error_t("parse: unexpected EOF");
-    auto ret = stack.top();
-    if (ret->as_list() && ret->tail()->as_nil()) ret = ret->head(); // XXX
-    return ret->reverse();
+  object_sptr_t parser_t::finish() {
+    DEBUG_LOGGER_TRACE_LISP;
+    switch (state) {
+      case state_t::string:
+        throw error_t("parse: unexpected EOF in string at " + token_loc.show());
+      case state_t::number:
+      case state_t::ident:
+        emit_atom(state, pending);
+        break;
+      case state_t::minus:
+        emit_atom(state_t::ident, pending);
+        break;
+      default:
+        break;
+    }
+    pending.clear();
+    state = state_t::none;
+
+    if (stack.size() != 1) throw error_t("parse: unexpected EOF, '(' at " + stack.back().loc.show() + " is not closed");
+    auto ret = stack.back().head;
+    stack.back() = {object_t::nil(), nullptr, {file, 1, 1}};
+    return ret;
   }
 
-}
+  interpreter_t::interpreter_t(const std::string& stdlib) : env(std::make_shared<env_t>()) {
+    ctx.out = &stdout_out;
+    if (!stdlib.empty()) eval_file(stdlib);
+  }
+
+  object_sptr_t interpreter_t::eval(std::string_view code) {
+    return counted([this, code] {
+      object_sptr_t forms;
+      uint64_t time = 0;
+      {
+        LOG_DURATION(time);
+        parser_t parser;
+        parser.feed(code);
+        forms = parser.finish();
+      }
+      ctx.metrics.time_parse += time;
+      auto ret = object_t::nil();
+      {
+        LOG_DURATION(time);
+        forms->for_each([this, &ret](object_sptr_t form) -> bool {
+          ret = form->eval(env, ctx);
+          return true;
+        });
+      }
+      ctx.metrics.time_eval += time;
+      return ret;
+    });
+  }
 
+  object_sptr_t interpreter_t::eval_file(const std::string& path) {
+    return counted([this, &path] {
+      auto args = object_t::list(object_t::string(path), object_t::nil());
+      return object_t::eval_load(object_t::nil(), args, env, ctx);
+    });
+  }
+
+}
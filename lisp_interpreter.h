@@ -1,3 +1,4 @@
+#pragma once
 
 #include <iostream>
 #include <memory>
@@ -7,18 +8,32 @@
 #include <algorithm>
 #include <sstream>
 #include <fstream>
+#include <filesystem>
+#include <vector>
+#include <set>
+#include <string_view>
+#include <charconv>
+#include <bit>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <unordered_map>
+#include <utility>
 
 #include "debug_logger.h"
+#include "mapped_file.h"
+#include "profiler.h"
+#include "output_sink.h"
+#include "file_stream.h"
+#include "hamt.h"
+#include "packed_vector.h"
+#include "simd_scan.h"
 
 
 
-#define DEBUG_LOGGER_TRACE_LISP          // DEBUG_LOGGER("lisp ", logger_indent_lisp_t::indent)
-#define DEBUG_LOGGER_LISP(...)           // DEBUG_LOG("lisp ", logger_indent_lisp_t::indent, __VA_ARGS__)
-
-template <typename T>
-struct logger_indent_t { static inline int indent; };
-
-struct logger_indent_lisp_t   : logger_indent_t<logger_indent_lisp_t> { };
+#define DEBUG_LOGGER_TRACE_LISP          TRACE_SCOPE()
+#define DEBUG_LOGGER_LISP(name, object)  if (!trace_t::enabled()) { } else trace_object(name, __LINE__, object)
 
 
 
@@ -39,6 +54,49 @@ namespace lisp_interpreter {
   struct object_t;
   using object_sptr_t = std::shared_ptr<const object_t>;
 
+  struct parser_t;
+  struct interpreter_t;
+  struct context_t;
+
+  template <typename T>
+  struct convert_t;
+
+  struct print_limits_t {
+    size_t depth  = SIZE_MAX;
+    size_t length = SIZE_MAX; // elements per list
+  };
+
+  inline constexpr print_limits_t print_brief = {4, 16}; // error messages and logs
+
+  void trace_object(const char* name, uint32_t line, const object_t* object);
+
+  inline void trace_object(const char* name, uint32_t line, const object_sptr_t& object) {
+    trace_object(name, line, object.get());
+  }
+
+  inline void trace_object(const char* name, uint32_t line, const void* pointer) {
+    trace_t::value(name, line, pointer);
+  }
+
+
+  struct source_loc_t {
+    const std::string*   file   = nullptr;
+    uint32_t             line   = 0;
+    uint32_t             column = 0;
+
+    // File names live as long as the process, locations keep only a pointer.
+    static const std::string* intern(const std::string& file) {
+      static std::mutex mutex;
+      static std::set<std::string> files;
+      std::lock_guard lock(mutex);
+      return &*files.insert(file).first;
+    }
+
+    std::string show() const {
+      return (file ? *file + ":" : ""s) + std::to_string(line) + ":" + std::to_string(column);
+    }
+  };
+
 
   struct error_t : std::runtime_error {
     error_t(const std::string& msg) : std::runtime_error(msg) { }
@@ -49,8 +107,17 @@ namespace lisp_interpreter {
   struct env_base_t : std::enable_shared_from_this<env_base_t<tkey_t, tval_t>> {
     using env_t = env_base_t<tkey_t, tval_t>;
 
-    std::map<tkey_t, tval_t>   frames;
-    std::shared_ptr<env_t>     parent;
+    struct module_t {
+      std::filesystem::file_time_type   mtime;
+      uintmax_t                         size;
+      std::vector<tkey_t>               keys;
+      tval_t                            result;
+    };
+
+    std::map<tkey_t, tval_t>        frames;
+    std::shared_ptr<env_t>          parent;
+    std::map<std::string, module_t> modules;
+    bool                            toplevel = false; // forms of a loaded file, see context_t::lazy_defs
 
     env_base_t(std::shared_ptr<env_t> parent = nullptr) : parent(parent) { }
 
@@ -59,33 +126,109 @@ namespace lisp_interpreter {
       auto it = frames.find(key);
       if (it != frames.end()) throw error_t("env_base_t:defvar: value '" + key + "' is exists");
       frames[key] = val;
-      DEBUG_LOGGER_LISP("env: defvar: %p   %s   %s", this, key.c_str(), val->show().c_str());
+      DEBUG_LOGGER_LISP("defvar", val);
       return val;
     }
 
+    // Like getvar, but nullptr for an unbound 'key' instead of an error.
+    const tval_t* findvar(const tkey_t& key) const {
+      const env_t* env = this;
+      while (env) {
+        auto it = env->frames.find(key);
+        if (it != env->frames.end()) return &it->second;
+        env = env->parent.get();
+      }
+      return nullptr;
+    }
+
     tval_t getvar(const tkey_t& key) const {
+      DEBUG_LOGGER_TRACE_LISP;
+      auto val = findvar(key);
+      if (!val) throw error_t("env_base_t:getvar: value '" + key + "' is not exists");
+      DEBUG_LOGGER_LISP("getvar", *val);
+      return *val;
+    }
+
+    // Rebinds the nearest 'key' in place, a forced lazy definition replaces its thunk.
+    void setvar(const tkey_t& key, const tval_t& val) {
       DEBUG_LOGGER_TRACE_LISP;
       auto env = this->shared_from_this();
       while (env) {
-        auto &frames = env->frames;
-        auto it = frames.find(key);
-        if (it != frames.end()) {
-          DEBUG_LOGGER_LISP("env: getvar: %p   %s   %s", this, key.c_str(), it->second->show().c_str());
-          return it->second;
+        auto it = env->frames.find(key);
+        if (it != env->frames.end()) {
+          it->second = val;
+          return;
         }
         env = env->parent;
       }
-      throw error_t("env_base_t:getvar: value '" + key + "' is not exists");
+      throw error_t("env_base_t:setvar: value '" + key + "' is not exists");
+    }
+
+    const module_t* find_module(const std::string& path) const {
+      auto env = this->shared_from_this();
+      while (env) {
+        auto it = env->modules.find(path);
+        if (it != env->modules.end()) return &it->second;
+        env = env->parent;
+      }
+      return nullptr;
+    }
+
+    // Throws if binding 'keys' for the module at 'path' would replace a value
+    // that is neither an old binding of this module nor in 'owned'.
+    void check_module(const std::string& path, const std::vector<tkey_t>& keys, const std::set<tkey_t>& owned = {}) const {
+      std::set<tkey_t> keys_old;
+      auto it = modules.find(path);
+      if (it != modules.end()) keys_old.insert(it->second.keys.begin(), it->second.keys.end());
+
+      for (const auto& key : keys) {
+        if (frames.count(key) && !keys_old.count(key) && !owned.count(key))
+          throw error_t("env_base_t:check_module: value '" + key + "' is exists");
+      }
+    }
+
+    // Moves the bindings of a module evaluated in 'staged' into this env.
+    // Old bindings of the same module are replaced, nothing is changed on error.
+    void commit_module(const std::string& path, module_t module, const env_t& staged) {
+      DEBUG_LOGGER_TRACE_LISP;
+      std::set<tkey_t> owned;
+      for (const auto& kv : staged.modules) {
+        owned.insert(kv.second.keys.begin(), kv.second.keys.end());
+      }
+
+      std::vector<tkey_t> keys;
+      for (const auto& kv : staged.frames) {
+        keys.push_back(kv.first);
+      }
+      check_module(path, keys, owned);
+
+      auto it = modules.find(path);
+      if (it != modules.end()) {
+        for (const auto& key : it->second.keys) {
+          frames.erase(key);
+        }
+      }
+
+      module.keys.clear();
+      for (const auto& kv : staged.frames) {
+        frames[kv.first] = kv.second;
+        if (!owned.count(kv.first)) module.keys.push_back(kv.first);
+      }
+
+      for (const auto& kv : staged.modules) {
+        modules[kv.first] = kv.second;
+      }
+      modules[path] = std::move(module);
     }
 
     void show() const {
+      if (!trace_t::enabled()) return;
       DEBUG_LOGGER_TRACE_LISP;
-      std::string ret;
       auto env = this->shared_from_this();
       while (env) {
         auto &frames = env->frames;
         for (const auto& kv : frames) {
-          DEBUG_LOGGER_LISP("env: %p \t key: %s \t val: %s", env.get(), kv.first.c_str(), kv.second->show().c_str());
+          DEBUG_LOGGER_LISP("val", kv.second);
         }
         env = env->parent;
       }
@@ -96,20 +239,155 @@ namespace lisp_interpreter {
   using env_sptr_t = std::shared_ptr<env_t>;
 
 
+  // Process wide counters, interpreters on other threads create objects too.
+  // Each thread counts into a block of its own, so threads don't write the
+  // same cache lines; readers sum the blocks. The peak of live objects is
+  // updated every 'peak_batch' allocations or frees of a thread, it may miss
+  // up to that many objects per thread.
+  struct runtime_stats_t {
+    static constexpr size_t  kinds_max  = 16;
+    static constexpr size_t  blocks_max = 64; // more threads share the first block
+    static constexpr int64_t peak_batch = 256;
+
+    struct alignas(64) block_t {
+      std::atomic<uint64_t> allocations[kinds_max] = {};
+      std::atomic<uint64_t> bytes      = 0;
+      std::atomic<int64_t>  live       = 0;
+      std::atomic<uint64_t> exceptions = 0;
+      std::atomic<bool>     busy       = false; // owned by a running thread
+    };
+
+    void on_alloc(size_t kind, size_t size) {
+      auto& b = block();
+      b.allocations[kind].fetch_add(1, std::memory_order_relaxed);
+      b.bytes.fetch_add(size, std::memory_order_relaxed);
+      b.live.fetch_add(1, std::memory_order_relaxed);
+      if (++pending >= peak_batch) flush();
+    }
+
+    void on_free() {
+      block().live.fetch_sub(1, std::memory_order_relaxed);
+      if (--pending <= -peak_batch) flush();
+    }
+
+    void on_exception() {
+      block().exceptions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t allocations(size_t kind) const {
+      return sum<uint64_t>([kind](const block_t& b) { return b.allocations[kind].load(std::memory_order_relaxed); });
+    }
+
+    uint64_t bytes() const {
+      return sum<uint64_t>([](const block_t& b) { return b.bytes.load(std::memory_order_relaxed); });
+    }
+
+    int64_t live() const {
+      return sum<int64_t>([](const block_t& b) { return b.live.load(std::memory_order_relaxed); });
+    }
+
+    int64_t live_peak() const {
+      return std::max(peak.load(std::memory_order_relaxed), live());
+    }
+
+    uint64_t exceptions() const {
+      return sum<uint64_t>([](const block_t& b) { return b.exceptions.load(std::memory_order_relaxed); });
+    }
+
+   private:
+    template <typename T, typename F>
+    T sum(F f) const {
+      T ret = 0;
+      for (const auto& b : blocks) {
+        ret += f(b);
+      }
+      return ret;
+    }
+
+    block_t& block() {
+      if (!current) current = acquire();
+      return *current;
+    }
+
+    // A free block for this thread, given back when the thread exits. Its
+    // counts stay and are summed with those of the next owner.
+    block_t* acquire() {
+      if (exited) return &blocks[0];
+      for (auto& b : blocks) {
+        bool expected = false;
+        if (!b.busy.compare_exchange_strong(expected, true)) continue;
+        struct release_t {
+          ~release_t() {
+            runtime_stats_t::exited = true;
+            runtime_stats_t::current->busy.store(false);
+            runtime_stats_t::current = nullptr;
+          }
+        };
+        static thread_local release_t release;
+        return &b;
+      }
+      return &blocks[0];
+    }
+
+    void flush() {
+      auto count = live_batched.fetch_add(pending, std::memory_order_relaxed) + pending;
+      pending = 0;
+      auto prev = peak.load(std::memory_order_relaxed);
+      while (count > prev && !peak.compare_exchange_weak(prev, count, std::memory_order_relaxed)) { }
+    }
+
+    block_t               blocks[blocks_max];
+    std::atomic<int64_t>  live_batched = 0;
+    std::atomic<int64_t>  peak         = 0;
+
+    // Trivial thread locals, objects are still freed after the thread's destructors ran.
+    static inline thread_local block_t* current = nullptr;
+    static inline thread_local int64_t  pending = 0;
+    static inline thread_local bool     exited  = false;
+  };
+
+  inline runtime_stats_t runtime_stats;
+
+
+  struct metrics_t {
+    uint64_t eval_calls       = 0;
+    uint64_t time_parse       = 0; // ns
+    uint64_t time_eval        = 0; // ns
+    uint64_t stack_level      = 0;
+    uint64_t stack_level_max  = 0;
+    uint64_t env_frames       = 0;
+    uint64_t macro_expansions = 0;
+
+    void merge(const metrics_t& other);
+
+    // Context counters together with runtime_stats.
+    void show_json(std::ostream& os) const;
+    void show_prometheus(std::ostream& os) const;
+  };
+
+
   struct context_t {
-    std::stringstream stream;
-    size_t eval_calls;
-    uint64_t time_parse;
-    uint64_t time_eval;
-    // size_t stack_level_max;
-    // size_t stack_level;
-
-    context_t() : stream{}, eval_calls{} { }
+    memory_sink_t stream; // default output
+    output_sink_t* out;
+    profiler_t* profiler;
+    metrics_t metrics;
+    bool lazy_defs = false; // top-level defs are evaluated on first use, (lazy-defs flag)
+    bool hash_consing = false; // lists and strings are interned, (hash-consing flag)
+
+    context_t() : stream{}, out{&stream}, profiler{}, metrics{} { }
+    context_t(const context_t&) = delete;
+    context_t& operator=(const context_t&) = delete;
   };
 
 
   struct object_t : std::enable_shared_from_this<object_t> {
 
+    friend struct parser_t;
+    friend struct interpreter_t;
+    template <typename T>
+    friend struct convert_t;
+    friend void trace_object(const char*, uint32_t, const object_t*);
+
     struct object_nil_t { };
     using object_nil_sptr_t = std::shared_ptr<const object_nil_t>;
 
@@ -122,18 +400,99 @@ namespace lisp_interpreter {
     struct object_list_t;
     using object_list_sptr_t = std::shared_ptr<const object_list_t>;
 
+    struct object_string_t;
+    using object_string_sptr_t = std::shared_ptr<const object_string_t>;
+
+    // Flat strings and slices view a shared buffer, so substrings copy nothing.
+    // A concatenation keeps both parts and is flattened into a buffer of its
+    // own on the first flat(), which drops the parts; comparing and printing
+    // read the parts in place. Like seq and thunk caches, a rope is changed
+    // under const by flat() and is not shared between threads.
     struct object_string_t {
-      std::string value;
+      // First byte of the buffer, owning what holds it: a string or a mapped file.
+      using buffer_t = std::shared_ptr<const char>;
 
-      object_string_t(const std::string& value) : value(value) { }
-    };
+      static constexpr size_t flat_max = 64; // shorter concatenations are copied
 
-    using object_string_sptr_t = std::shared_ptr<const object_string_t>;
+      mutable std::atomic<size_t>   hash     = 0; // 0 until computed
+      bool                          interned = false;
+
+      object_string_t(std::string value);
+      object_string_t(buffer_t buffer, size_t offset, size_t size);
+      object_string_t(object_string_sptr_t left, object_string_sptr_t right);
+      ~object_string_t();
+
+      size_t size() const {
+        return length;
+      }
+
+      std::string_view flat() const;
+      // Buffer and offset of flat(), for slices that share it.
+      std::pair<buffer_t, size_t> buffer() const;
+
+      // f(std::string_view) for every part in order, without flattening.
+      // The walk stops early when f returns false.
+      void for_each_chunk(auto f) const {
+        auto call = [&f] (std::string_view chunk) {
+          if constexpr (std::is_same_v<decltype(f(chunk)), bool>) {
+            return f(chunk);
+          } else {
+            f(chunk);
+            return true;
+          }
+        };
+        if (is_flat()) {
+          call(view());
+          return;
+        }
+        std::vector<const object_string_t*> stack{this};
+        while (!stack.empty()) {
+          auto str = stack.back();
+          stack.pop_back();
+          if (str->is_flat()) {
+            if (!call(str->view())) return;
+          } else {
+            stack.push_back(str->right.get());
+            stack.push_back(str->left.get());
+          }
+        }
+      }
+
+      int compare(const object_string_t& other) const;
+
+      bool equals(const object_string_t& other) const {
+        return length == other.length && compare(other) == 0;
+      }
+
+      // Bytes of the buffer this string allocated itself.
+      size_t own_bytes() const {
+        return owned;
+      }
+
+     private:
+      bool is_flat() const {
+        return !left;
+      }
+
+      // The bytes of a flat string.
+      std::string_view view() const {
+        return {buf.get() + offset, length};
+      }
+
+      static buffer_t own(std::string str);
+
+      mutable buffer_t              buf; // set for flat strings and slices, and once flattened
+      mutable size_t                offset = 0;
+      size_t                        length;
+      mutable object_string_sptr_t  left; // parts of a concatenation, dropped once flattened
+      mutable object_string_sptr_t  right;
+      size_t                        owned = 0; // capacity of the buffer allocated by this string
+    };
 
     struct object_ident_t {
       std::string value;
 
-      object_ident_t(const std::string& value) : value(value) { }
+      object_ident_t(std::string value) : value(std::move(value)) { }
     };
 
     using object_ident_sptr_t = std::shared_ptr<const object_ident_t>;
@@ -142,6 +501,7 @@ namespace lisp_interpreter {
       object_sptr_t   args;
       object_sptr_t   body;
       env_sptr_t      env;
+      mutable std::string name; // set by first def
 
       object_lambda_t(object_sptr_t args, object_sptr_t body, env_sptr_t env)
         : args(args), body(body), env(env) { }
@@ -150,18 +510,130 @@ namespace lisp_interpreter {
     struct object_macro_t {
       object_sptr_t   args;
       object_sptr_t   body;
+      mutable std::string name; // set by first def
 
       object_macro_t(object_sptr_t args, object_sptr_t body)
         : args(args), body(body) { }
     };
 
     struct object_list_t {
-      object_sptr_t   head;
-      object_sptr_t   tail;
+      object_sptr_t                 head;
+      object_sptr_t                 tail;
+      source_loc_t                  loc; // of the head, set by parser
+      mutable std::atomic<size_t>   hash     = 0; // structural, 0 until computed
+      bool                          interned = false; // the whole structure is hash-consed
+
+      object_list_t(object_sptr_t head, object_sptr_t tail, source_loc_t loc = {})
+        : head(head), tail(tail), loc(loc) { }
+    };
+
+    // Open file, the cursor and buffer change under a const object.
+    struct object_file_t {
+      std::string                             path;
+      mutable std::unique_ptr<line_reader_t>  reader;
+      mutable std::unique_ptr<file_writer_t>  writer;
+
+      object_file_t(std::string path) : path(std::move(path)) { }
+    };
+
+    using object_file_sptr_t = std::shared_ptr<const object_file_t>;
+
+    // Lazy sequence: elements of a range, list or other seq passed through
+    // map/filter stages. The first cell is computed on demand and cached.
+    struct object_seq_t {
+      struct cursor_t {
+        object_sptr_t   source; // list, nil or seq; nullptr for a range
+        int64_t         from = 0;
+        int64_t         to   = 0;
+      };
+
+      struct stage_t {
+        bool            filter;
+        object_sptr_t   f;
+        env_sptr_t      env; // expands a macro 'f', nullptr otherwise
+      };
+
+      using stages_t = std::shared_ptr<const std::vector<stage_t>>;
+
+      cursor_t                cursor;
+      stages_t                stages;
+      mutable bool            forced = false;
+      mutable object_sptr_t   first; // nullptr for an empty seq
+      mutable object_sptr_t   rest;
+
+      object_seq_t(cursor_t cursor, stages_t stages) : cursor(std::move(cursor)), stages(std::move(stages)) { }
+    };
+
+    using object_seq_sptr_t = std::shared_ptr<const object_seq_t>;
+
+    // Host function, arguments are evaluated before the call.
+    struct object_native_t {
+      static constexpr size_t args_max = 8;
+
+      using function_t = std::function<object_sptr_t(const object_sptr_t* args, size_t count, context_t& ctx)>;
+
+      std::string   name;
+      function_t    function;
+
+      object_native_t(std::string name, function_t function) : name(std::move(name)), function(std::move(function)) { }
+    };
+
+    using object_native_sptr_t = std::shared_ptr<const object_native_t>;
+
+    // Keys are hashed and compared by structure, as equal? compares them.
+    struct key_hash_t {
+      size_t operator()(const object_sptr_t& key) const {
+        return key->hash();
+      }
+    };
+
+    struct key_equal_t {
+      bool operator()(const object_sptr_t& x, const object_sptr_t& y) const {
+        return equal(x, y);
+      }
+    };
+
+    using hamt_map_t = hamt_t<object_sptr_t, object_sptr_t, key_hash_t, key_equal_t>;
+
+    struct object_map_t {
+      hamt_map_t map;
 
-      object_list_t(object_sptr_t head, object_sptr_t tail) : head(head), tail(tail) { }
+      object_map_t(hamt_map_t map) : map(std::move(map)) { }
     };
 
+    using object_map_sptr_t = std::shared_ptr<const object_map_t>;
+
+    // Packed numbers, all ints or all doubles. Comparisons give masks, int vecs of 0 and 1.
+    struct object_vec_t {
+      using values_t = std::variant<packed_array_t<int64_t>, packed_array_t<double>>;
+
+      values_t values;
+
+      object_vec_t(values_t values) : values(std::move(values)) { }
+
+      size_t size() const {
+        return std::visit([] (const auto& v) { return v.size(); }, values);
+      }
+    };
+
+    using object_vec_sptr_t = std::shared_ptr<const object_vec_t>;
+
+    // Top-level def bound while context_t::lazy_defs is on. The expression is evaluated
+    // on the first lookup; the value stays here for envs holding the same thunk.
+    struct object_thunk_t {
+      std::string             name;
+      source_loc_t            loc; // of the expression, reported with its errors
+      mutable object_sptr_t   expr; // dropped once forced
+      mutable env_sptr_t      env;
+      mutable object_sptr_t   value; // nullptr until forced
+      mutable bool            forcing = false;
+
+      object_thunk_t(std::string name, source_loc_t loc, object_sptr_t expr, env_sptr_t env)
+        : name(std::move(name)), loc(loc), expr(std::move(expr)), env(std::move(env)) { }
+    };
+
+    using object_thunk_sptr_t = std::shared_ptr<const object_thunk_t>;
+
     using variant_t = std::variant<
       object_nil_sptr_t,      // nil
       bool,                   // bool
@@ -171,19 +643,25 @@ namespace lisp_interpreter {
       object_ident_sptr_t,    // ident
       object_list_sptr_t,     // list
       object_lambda_sptr_t,   // lambda
-      object_macro_sptr_t     // macro
+      object_macro_sptr_t,    // macro
+      object_file_sptr_t,     // file
+      object_seq_sptr_t,      // seq
+      object_native_sptr_t,   // native
+      object_map_sptr_t,      // map
+      object_vec_sptr_t,      // vec
+      object_thunk_sptr_t     // lazy def
     >;
 
 
+    static_assert(std::variant_size_v<variant_t> <= runtime_stats_t::kinds_max);
+
     object_t(const variant_t& value) : value(value) {
       DEBUG_LOGGER_TRACE_LISP;
-      DEBUG_LOGGER_LISP("this: %p", this);
+      DEBUG_LOGGER_LISP("this", this);
+      runtime_stats.on_alloc(value.index(), sizeof(object_t) + payload_size(value));
     }
 
-    ~object_t() {
-      DEBUG_LOGGER_TRACE_LISP;
-      DEBUG_LOGGER_LISP("this: %p", this);
-    }
+    ~object_t();
 
    private:
     static object_sptr_t atom(const variant_t& value) {
@@ -196,14 +674,23 @@ namespace lisp_interpreter {
       return object;
     }
 
-    static object_sptr_t string(const std::string& str) {
-      auto l = std::make_shared<object_string_t>(str);
+    static object_sptr_t string(std::string str) {
+      auto l = std::make_shared<object_string_t>(std::move(str));
       variant_t v = l;
       return std::make_shared<object_t>(v);
     }
 
-    static object_sptr_t ident(const std::string& str) {
-      auto l = std::make_shared<object_ident_t>(str);
+    static object_sptr_t string(std::string str, const context_t& ctx) {
+      return ctx.hash_consing ? intern_string(std::move(str)) : string(std::move(str));
+    }
+
+    // Short results are copied, longer ones keep both parts.
+    static object_sptr_t string_concat(const object_string_sptr_t& x, const object_string_sptr_t& y, const context_t& ctx);
+    // Bytes [from, to) of 'str', sharing its buffer.
+    static object_sptr_t string_slice(const object_string_sptr_t& str, size_t from, size_t to, const context_t& ctx);
+
+    static object_sptr_t ident(std::string str) {
+      auto l = std::make_shared<object_ident_t>(std::move(str));
       return std::make_shared<object_t>(l);
     }
 
@@ -212,6 +699,10 @@ namespace lisp_interpreter {
       return std::make_shared<object_t>(l);
     }
 
+    static object_sptr_t list(object_sptr_t head, object_sptr_t tail, const context_t& ctx) {
+      return ctx.hash_consing ? intern_list(head, tail) : list(head, tail);
+    }
+
     static object_sptr_t lambda(object_sptr_t args, object_sptr_t body, env_sptr_t env) {
       auto l = std::make_shared<object_lambda_t>(args, body, env);
       return std::make_shared<object_t>(l);
@@ -222,6 +713,26 @@ namespace lisp_interpreter {
       return std::make_shared<object_t>(l);
     }
 
+    static object_sptr_t map(hamt_map_t value) {
+      auto l = std::make_shared<object_map_t>(std::move(value));
+      return std::make_shared<object_t>(l);
+    }
+
+    static object_sptr_t vec(object_vec_t::values_t values) {
+      auto l = std::make_shared<object_vec_t>(std::move(values));
+      return std::make_shared<object_t>(l);
+    }
+
+    static object_sptr_t thunk(std::string name, source_loc_t loc, object_sptr_t expr, env_sptr_t env) {
+      auto l = std::make_shared<object_thunk_t>(std::move(name), loc, std::move(expr), std::move(env));
+      return std::make_shared<object_t>(l);
+    }
+
+    static object_sptr_t native(std::string name, object_native_t::function_t function) {
+      auto l = std::make_shared<object_native_t>(std::move(name), std::move(function));
+      return std::make_shared<object_t>(l);
+    }
+
     const bool* as_bool() const {
       return std::get_if<bool>(&value);
     }
@@ -250,13 +761,42 @@ namespace lisp_interpreter {
       return std::get_if<object_macro_sptr_t>(&value);
     }
 
+    const object_file_sptr_t* as_file() const {
+      return std::get_if<object_file_sptr_t>(&value);
+    }
+
+    const object_seq_sptr_t* as_seq() const {
+      return std::get_if<object_seq_sptr_t>(&value);
+    }
+
+    const object_map_sptr_t* as_map() const {
+      return std::get_if<object_map_sptr_t>(&value);
+    }
+
+    const object_vec_sptr_t* as_vec() const {
+      return std::get_if<object_vec_sptr_t>(&value);
+    }
+
+    const object_thunk_sptr_t* as_thunk() const {
+      return std::get_if<object_thunk_sptr_t>(&value);
+    }
+
+    const object_native_sptr_t* as_native() const {
+      return std::get_if<object_native_sptr_t>(&value);
+    }
+
+    // Callable by apply_lambda.
+    bool is_function() const {
+      return as_lambda() || as_macro() || as_native();
+    }
+
     object_sptr_t self() const {
       return shared_from_this();
     }
 
     std::pair<object_sptr_t, object_sptr_t> decompose() const {
       auto list = as_list();
-      if (!list) throw error_t("decompose: object '" + show() + "' is not list");
+      if (!list) throw error_t("decompose: object '" + show(print_brief) + "' is not list");
       return {(*list)->head, (*list)->tail};
     }
 
@@ -269,10 +809,15 @@ namespace lisp_interpreter {
     }
 
     object_sptr_t cons(object_sptr_t tail) const {
-      if (!tail->as_list() && !tail->as_nil()) throw error_t("cons: tail is not list");
+      if (!tail->as_list() && !tail->as_nil() && !tail->as_seq()) throw error_t("cons: tail is not list");
       return list(self(), tail);
     }
 
+    object_sptr_t cons(object_sptr_t tail, const context_t& ctx) const {
+      if (!tail->as_list() && !tail->as_nil() && !tail->as_seq()) throw error_t("cons: tail is not list");
+      return list(self(), tail, ctx);
+    }
+
     void for_each(auto f) const {
       auto object = self();
       while (object->as_list()) {
@@ -284,11 +829,57 @@ namespace lisp_interpreter {
 
     object_sptr_t reverse(bool recursive = true) const;
 
+    // Structural hash, cached on lists and strings. Equal objects have equal hashes.
+    size_t hash() const;
+    // Lists are equal when their elements have the same types and values,
+    // hash-consed lists are compared by pointer. There is one intern table for
+    // all contexts and modes, so two distinct interned objects always differ.
+    // Cells made by cons while the mode is on may stay plain (see intern_list),
+    // they are compared by structure.
+    static bool equal(const object_sptr_t& x, const object_sptr_t& y);
+
+    bool is_interned() const {
+      if (auto v = as_list()) return *v && (*v)->interned;
+      if (auto v = as_string()) return *v && (*v)->interned;
+      return false;
+    }
+
+    // Hash-consing: identical lists and strings made by the list() and string()
+    // overloads taking a context share one object while the context's mode is
+    // on. The others, used for code and temporaries, never intern. intern()
+    // converts an existing structure.
+    static object_sptr_t intern_string(std::string str);
+    static object_sptr_t intern_list(object_sptr_t head, object_sptr_t tail);
+    static object_sptr_t intern(object_sptr_t object);
+    static void unintern(const object_t* object);
+    static void unintern_locked(const object_t* object); // the caller holds intern_mutex()
+    static std::mutex& intern_mutex();
+
+    // Lazy defs: top-level defs of lists bind thunks while ctx.lazy_defs is on.
+    // lookup() forces a thunk and rebinds the name to the value.
+    static object_sptr_t lookup(env_sptr_t env, const std::string& name, context_t& ctx);
+    static object_sptr_t force(const object_thunk_t& thunk, context_t& ctx);
+
+    static size_t payload_size(const variant_t& value);
+    // Moves lists and seqs referenced only by 'object' into 'next' or 'more',
+    // ~object_t releases them in a loop.
+    static void unlink(const object_t& object, object_sptr_t& next, std::vector<object_sptr_t>& more);
+
+    static source_loc_t location(object_sptr_t args, object_sptr_t body);
+    template <typename T>
+    static std::string profile_name(const T& function, const char* kind);
+
     static object_sptr_t eval_plus       (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
     static object_sptr_t eval_minus      (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
     static object_sptr_t eval_multiplies (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
     static object_sptr_t eval_equal      (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
     static object_sptr_t eval_less       (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_substring  (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_string_length(object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_string_find(object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_string_count(object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_string_split(object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_string_replace(object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
     static object_sptr_t eval_println    (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
     static object_sptr_t eval_if         (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
     static object_sptr_t eval_quote      (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
@@ -300,21 +891,322 @@ namespace lisp_interpreter {
     static object_sptr_t eval_lambda     (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
     static object_sptr_t eval_macro      (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
     static object_sptr_t eval_load       (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_load_data  (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_open       (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_close      (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_read_line  (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_fold_lines (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_write      (object_sptr_t, object_sptr_t, env_sptr_t, context_t&, bool newline);
+    static object_sptr_t eval_range      (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_stage      (object_sptr_t, object_sptr_t, env_sptr_t, context_t&, bool filter);
+    static object_sptr_t eval_foldl      (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_hash       (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_assoc      (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_dissoc     (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_get        (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_contains   (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_size       (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_entries    (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_to_map     (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_vec        (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_vec_list   (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_vec_zip    (object_sptr_t, object_sptr_t, env_sptr_t, context_t&, packed_op_t op);
+    static object_sptr_t eval_vec_reduce (object_sptr_t, object_sptr_t, env_sptr_t, context_t&, packed_op_t op);
+    static object_sptr_t eval_vec_dot    (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_vec_select (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_hash_consing(object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_lazy_defs  (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
     static object_sptr_t eval_call       (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
     static object_sptr_t eval_list       (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
     static object_sptr_t eval_def        (object_sptr_t, object_sptr_t, env_sptr_t, env_sptr_t, context_t&, bool need_eval = true);
     static object_sptr_t eval_call_lambda(object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
     static object_sptr_t eval_call_macro (object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+    static object_sptr_t eval_call_native(object_sptr_t, object_sptr_t, env_sptr_t, context_t&);
+
+    // Calls a lambda, a macro or a native function with already evaluated
+    // arguments. A macro gets them quoted, the expansion is evaluated in 'env'.
+    static object_sptr_t apply_lambda(object_sptr_t, std::initializer_list<object_sptr_t>, context_t&, env_sptr_t env = nullptr);
+
+    // Cursor and stages that read 'object' (list, nil or seq). An unforced seq
+    // that only the caller holds is fused; pass a temporary by std::move.
+    static std::pair<object_seq_t::cursor_t, object_seq_t::stages_t> seq_view(object_sptr_t object, const char* fn, const context_t& ctx);
+    // Next element of the cursor after the stages, false at the end.
+    static bool seq_next(object_seq_t::cursor_t& cursor, const object_seq_t::stages_t& stages, object_sptr_t& value, context_t& ctx);
+    static const object_seq_t& seq_force(const object_seq_t& seq, context_t& ctx);
+    // Seqs and lists ending in a seq become lists, other objects are returned as is.
+    static object_sptr_t seq_to_list(object_sptr_t object, context_t& ctx);
+
+    // List of (key value) lists.
+    static object_sptr_t map_entries(const hamt_map_t& map, const context_t& ctx);
+
+    // Line of 'reader' as a string, or a list of fields split on 'sep' when it is not 0.
+    static object_sptr_t line_value(const line_reader_t& reader, std::string_view line, char sep, const context_t& ctx);
 
     variant_t value;
 
    public:
 
     object_sptr_t eval(env_sptr_t env, context_t& ctx) const;
-    std::string show() const;
+    // Unforced seqs print as #<seq>, printing never evaluates code.
+    std::string show(print_limits_t limits = {}) const;
+    void print(output_sink_t& out, print_limits_t limits = {}) const;
+    // Forces the seqs print shows within 'limits', user code runs in 'ctx'.
+    void realize(context_t& ctx, print_limits_t limits = {}) const;
+
+    static const char* type_name(size_t index);
+
+    static object_sptr_t parse(std::string_view str);
+    static object_sptr_t parse_file(const std::string& path);
+
+  };
+
+
+  // Incremental parser. Input may be fed in chunks of any size, tokens split
+  // between chunks are carried over. Lists are built in order.
+  struct parser_t {
+    parser_t(source_loc_t start = {nullptr, 1, 1});
+
+    void feed(std::string_view chunk);
+    object_sptr_t finish(); // list of top-level forms
 
-    static object_sptr_t parse(const std::string& str);
+   private:
+    enum class state_t { none, comment, string, number, ident, minus };
+
+    struct frame_t {
+      object_sptr_t                                  head;
+      std::shared_ptr<object_t::object_list_t>       last;
+      source_loc_t                                   loc;
+    };
+
+    void push(object_sptr_t object, source_loc_t loc);
+    void open_list();
+    void close_list();
+    void emit_atom(state_t state, std::string_view token);
+    void advance(std::string_view text);
+    source_loc_t loc() const;
+
+    std::vector<frame_t>   stack;
+    std::string            pending;
+    const std::string*     file;
+    state_t                state;
+    source_loc_t           token_loc;
+    size_t                 offset;
+    size_t                 line;
+    size_t                 line_start;
+  };
+
+
+  // Conversions between C++ values and objects. to() checks the type of an
+  // argument, 'index' is its position for the error message.
+  template <>
+  struct convert_t<object_sptr_t> {
+    static object_sptr_t to(const object_sptr_t& object, context_t&, const std::string&, size_t) {
+      return object;
+    }
+
+    static object_sptr_t from(object_sptr_t value) {
+      return value;
+    }
+  };
+
+  template <>
+  struct convert_t<bool> {
+    static bool to(const object_sptr_t& object, context_t&, const std::string& fn, size_t index) {
+      auto v = object->as_bool();
+      if (!v) throw error_t(fn + ": argument #" + std::to_string(index) + " is not bool");
+      return *v;
+    }
+
+    static object_sptr_t from(bool value) {
+      return object_t::atom(value);
+    }
+  };
+
+  template <>
+  struct convert_t<int64_t> {
+    static int64_t to(const object_sptr_t& object, context_t&, const std::string& fn, size_t index) {
+      auto v = std::get_if<int64_t>(&object->value);
+      if (!v) throw error_t(fn + ": argument #" + std::to_string(index) + " is not int");
+      return *v;
+    }
+
+    static object_sptr_t from(int64_t value) {
+      return object_t::atom(value);
+    }
+  };
+
+  // Ints are accepted where a double is expected.
+  template <>
+  struct convert_t<double> {
+    static double to(const object_sptr_t& object, context_t&, const std::string& fn, size_t index) {
+      if (auto v = std::get_if<double>(&object->value)) return *v;
+      if (auto v = std::get_if<int64_t>(&object->value)) return *v;
+      throw error_t(fn + ": argument #" + std::to_string(index) + " is not number");
+    }
+
+    static object_sptr_t from(double value) {
+      return object_t::atom(value);
+    }
+  };
+
+  // The view is valid during the call.
+  template <>
+  struct convert_t<std::string_view> {
+    static std::string_view to(const object_sptr_t& object, context_t&, const std::string& fn, size_t index) {
+      auto v = object->as_string();
+      if (!v) throw error_t(fn + ": argument #" + std::to_string(index) + " is not string");
+      return (*v)->flat();
+    }
+
+    static object_sptr_t from(std::string_view value) {
+      return object_t::string(std::string(value));
+    }
+  };
+
+  template <>
+  struct convert_t<std::string> {
+    static std::string to(const object_sptr_t& object, context_t& ctx, const std::string& fn, size_t index) {
+      return std::string(convert_t<std::string_view>::to(object, ctx, fn, index));
+    }
+
+    static object_sptr_t from(std::string value) {
+      return object_t::string(std::move(value));
+    }
+  };
+
+  // Lists and seqs.
+  template <typename T>
+  struct convert_t<std::vector<T>> {
+    static std::vector<T> to(const object_sptr_t& object, context_t& ctx, const std::string& fn, size_t index) {
+      auto l = object_t::seq_to_list(object, ctx);
+      if (!l->as_list() && !l->as_nil()) throw error_t(fn + ": argument #" + std::to_string(index) + " is not list");
+      std::vector<T> ret;
+      l->for_each([&ret, &ctx, &fn, index](object_sptr_t item) -> bool {
+        ret.push_back(convert_t<T>::to(item, ctx, fn, index));
+        return true;
+      });
+      return ret;
+    }
+
+    static object_sptr_t from(const std::vector<T>& value) {
+      auto ret = object_t::nil();
+      for (auto it = value.rbegin(); it != value.rend(); ++it) {
+        ret = object_t::list(convert_t<T>::from(*it), ret);
+      }
+      return ret;
+    }
+  };
+
+
+  template <typename F>
+  struct function_traits_t : function_traits_t<decltype(&F::operator())> { };
+
+  template <typename R, typename... A>
+  struct function_traits_t<R(*)(A...)> {
+    using pointer_t = R(*)(A...);
+  };
+
+  template <typename R, typename... A>
+  struct function_traits_t<R(A...)> : function_traits_t<R(*)(A...)> { };
+
+  template <typename C, typename R, typename... A>
+  struct function_traits_t<R(C::*)(A...)> : function_traits_t<R(*)(A...)> { };
+
+  template <typename C, typename R, typename... A>
+  struct function_traits_t<R(C::*)(A...) const> : function_traits_t<R(*)(A...)> { };
+
+
+  // Embedding API: a global environment with its context.
+  struct interpreter_t {
+    // Loads the library file when 'stdlib' is not empty.
+    interpreter_t(const std::string& stdlib = "");
+
+    // Evaluates all top-level forms, returns the result of the last one.
+    // An exception leaving eval, eval_file or show is counted once in
+    // runtime_stats.
+    object_sptr_t eval(std::string_view code);
+    object_sptr_t eval_file(const std::string& path);
+
+    // println writes to stdout until another sink is set.
+    void set_output(output_sink_t& out) {
+      ctx.out = &out;
+    }
+
+    void set_hash_consing(bool value) {
+      ctx.hash_consing = value;
+    }
+
+    // Defs of files loaded afterwards are evaluated on first use.
+    void set_lazy_defs(bool value) {
+      ctx.lazy_defs = value;
+    }
+
+    env_sptr_t environment() const {
+      return env;
+    }
+
+    const metrics_t& metrics() const {
+      return ctx.metrics;
+    }
+
+    // Printed form of 'object' with its seqs forced in this interpreter.
+    std::string show(const object_sptr_t& object, print_limits_t limits = {}) {
+      return counted([&] {
+        object->realize(ctx, limits);
+        return object->show(limits);
+      });
+    }
+
+    // Binds a callable under 'name'. Arguments and the result are converted
+    // by convert_t, the signature is taken from the callable. Like def, a name
+    // that is already bound is an error.
+    template <typename F>
+    void register_function(const std::string& name, F f) {
+      bind(name, std::move(f), typename function_traits_t<std::decay_t<F>>::pointer_t{});
+    }
+
+    template <typename T>
+    T to(const object_sptr_t& object) {
+      return convert_t<T>::to(object, ctx, "interpreter_t::to", 0);
+    }
+
+    template <typename T>
+    static object_sptr_t from(const T& value) {
+      return convert_t<T>::from(value);
+    }
+
+   private:
+    template <typename F>
+    static auto counted(F f) -> decltype(f()) {
+      try {
+        return f();
+      } catch (...) {
+        runtime_stats.on_exception();
+        throw;
+      }
+    }
+
+    template <typename F, typename R, typename... A>
+    void bind(const std::string& name, F f, R(*)(A...)) {
+      static_assert(sizeof...(A) <= object_t::object_native_t::args_max, "register_function: too many arguments");
+      auto function = [f = std::move(f), name](const object_sptr_t* args, size_t count, context_t& ctx) -> object_sptr_t {
+        if (count != sizeof...(A)) throw error_t(name + ": expected " + std::to_string(sizeof...(A)) + " arguments");
+        return [&]<size_t... I>(std::index_sequence<I...>) -> object_sptr_t {
+          if constexpr (std::is_void_v<R>) {
+            f(convert_t<std::decay_t<A>>::to(args[I], ctx, name, I + 1)...);
+            return object_t::nil();
+          } else {
+            auto ret = convert_t<std::decay_t<R>>::from(f(convert_t<std::decay_t<A>>::to(args[I], ctx, name, I + 1)...));
+            return ctx.hash_consing ? object_t::intern(ret) : ret;
+          }
+        }(std::index_sequence_for<A...>{});
+      };
+      env->defvar(name, object_t::native(name, std::move(function)));
+    }
 
+    env_sptr_t      env;
+    context_t       ctx;
+    stdout_sink_t   stdout_out;
   };
 
 }
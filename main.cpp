@@ -6,6 +6,8 @@
 #include <variant>
 #include <algorithm>
 #include <sstream>
+#include <fstream>
+#include <charconv>
 
 #include "lisp_interpreter.h"
 
@@ -20,13 +22,67 @@ int main() {
   // R E P L
   {
     auto env = std::make_shared<env_t>();
+    profiler_t profiler;
+    bool profiling = false;
+    metrics_t metrics;
+    std::unique_ptr<output_sink_t> out;
+    if (isatty(STDOUT_FILENO)) {
+      out = std::make_unique<stdout_sink_t>();
+    } else {
+      out = std::make_unique<fd_sink_t>(STDOUT_FILENO);
+    }
     std::string str;
     while (true) {
       context_t ctx;
+      ctx.out = out.get();
+      ctx.profiler = profiling ? &profiler : nullptr;
       std::cout << "lisp $ ";
       std::getline(std::cin, str);
 
-      if (str == ":l") {
+      if (str.rfind(":profile", 0) == 0) {
+        std::istringstream iss(str);
+        std::string cmd, arg;
+        iss >> cmd >> cmd >> arg;
+        size_t top = 20;
+        auto [top_end, top_ec] = std::from_chars(arg.data(), arg.data() + arg.size(), top);
+        bool top_ok = arg.empty() || (top_ec == std::errc() && top_end == arg.data() + arg.size());
+        if (cmd == "on") {
+          profiling = true;
+        } else if (cmd == "off") {
+          profiling = false;
+        } else if (cmd == "reset") {
+          profiler.reset();
+        } else if (cmd == "top" && top_ok) {
+          profiler.show_top(std::cout, top);
+        } else if (cmd == "flame" && !arg.empty()) {
+          std::ofstream ofs(arg);
+          profiler.show_collapsed(ofs);
+        } else {
+          std::cout << "usage: :profile on|off|reset|top [N]|flame FILE" << std::endl;
+        }
+        continue;
+      } else if (str.rfind(":trace", 0) == 0) {
+        std::istringstream iss(str);
+        std::string cmd, arg;
+        iss >> cmd >> cmd >> arg;
+        if (cmd == "on" || cmd == "off") {
+          trace_t::enable(cmd == "on");
+        } else if (cmd == "clear") {
+          trace_t::clear();
+        } else if (cmd == "dump" && !arg.empty()) {
+          if (!trace_t::dump(arg)) std::cout << "trace: can't write '" << arg << "'" << std::endl;
+        } else {
+          std::cout << "usage: :trace on|off|clear|dump FILE" << std::endl;
+        }
+        continue;
+      } else if (str == ":metrics" || str == ":metrics json") {
+        metrics.show_json(std::cout);
+        std::cout << std::endl;
+        continue;
+      } else if (str == ":metrics prom") {
+        metrics.show_prometheus(std::cout);
+        continue;
+      } else if (str == ":l") {
         env = std::make_shared<env_t>();
         str = "(__kernel_load \"standart.lispam\")";
       } else if (str == "") {
@@ -36,26 +92,31 @@ int main() {
       try {
         object_sptr_t l;
         {
-          LOG_DURATION(ctx.time_parse);
+          LOG_DURATION(ctx.metrics.time_parse);
           l = object_t::parse(str);
         }
         std::cout << "input: \t" << l->show() << std::endl;
         {
-          ctx.time_eval = 159;
-          LOG_DURATION(ctx.time_eval);
+          LOG_DURATION(ctx.metrics.time_eval);
           l = l->eval(env, ctx);
+          l->realize(ctx);
         }
+        out->flush();
         std::cout << "result: \t" << l->show() << std::endl;
       } catch (const std::exception& e) {
+        runtime_stats.on_exception();
+        out->flush();
         std::cout << "exception: \t" << e.what() << std::endl;
       } catch (...) {
+        runtime_stats.on_exception();
+        out->flush();
         std::cout << "exception" << std::endl;
       }
 
-      std::cout << "eval_calls: \t" << ctx.eval_calls << std::endl;
-      std::cout << "time_parse: \t" << ctx.time_parse << " ms" << std::endl;
-      std::cout << "time_eval: \t" << ctx.time_eval << " ms" << std::endl;
-      std::cout << "stream: \t" << ctx.stream.str() << std::endl;
+      std::cout << "eval_calls: \t" << ctx.metrics.eval_calls << std::endl;
+      std::cout << "time_parse: \t" << ctx.metrics.time_parse << " ns" << std::endl;
+      std::cout << "time_eval: \t" << ctx.metrics.time_eval << " ns" << std::endl;
+      metrics.merge(ctx.metrics);
     }
   }
 
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+
+// Read-only view of a whole file. Uses mmap, empty files give an empty view.
+struct mapped_file_t {
+  mapped_file_t(const std::string& path) : data(nullptr), size(0) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return;
+
+    struct stat st;
+    if (::fstat(fd, &st) == 0) {
+      if (st.st_size == 0) {
+        opened = true;
+      } else {
+        void* ptr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr != MAP_FAILED) {
+          ::madvise(ptr, st.st_size, MADV_SEQUENTIAL);
+          data = static_cast<const char*>(ptr);
+          size = st.st_size;
+          opened = true;
+        }
+      }
+    }
+    ::close(fd);
+  }
+
+  ~mapped_file_t() {
+    if (data) ::munmap(const_cast<char*>(data), size);
+  }
+
+  mapped_file_t(const mapped_file_t&) = delete;
+  mapped_file_t& operator=(const mapped_file_t&) = delete;
+
+  bool is_open() const {
+    return opened;
+  }
+
+  std::string_view view() const {
+    return {data, size};
+  }
+
+  // Drops resident pages before 'offset', they are read again on access.
+  void release(size_t offset) {
+    size_t page = ::sysconf(_SC_PAGESIZE);
+    offset = std::min(offset, size) / page * page;
+    if (data && offset) ::madvise(const_cast<char*>(data), offset, MADV_DONTNEED);
+  }
+
+ private:
+  const char* data;
+  size_t      size;
+  bool        opened = false;
+};
+
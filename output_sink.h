@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cerrno>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <unistd.h>
+
+
+
+// Byte sink for program output.
+struct output_sink_t {
+  virtual ~output_sink_t() = default;
+
+  virtual void write(const char* data, size_t size) = 0;
+  virtual void flush() { }
+
+  void write(std::string_view str) {
+    write(str.data(), str.size());
+  }
+
+  void put(char c) {
+    write(&c, 1);
+  }
+
+ protected:
+  static void write_fd(int fd, const char* data, size_t size) {
+    while (size) {
+      auto ret = ::write(fd, data, size);
+      if (ret < 0 && errno == EINTR) continue;
+      if (ret <= 0) return;
+      data += ret;
+      size -= ret;
+    }
+  }
+};
+
+// Every write goes straight to the descriptor.
+struct stdout_sink_t : output_sink_t {
+  void write(const char* data, size_t size) override {
+    write_fd(STDOUT_FILENO, data, size);
+  }
+
+  using output_sink_t::write;
+};
+
+// Buffered descriptor, written when the buffer is full or on flush().
+struct fd_sink_t : output_sink_t {
+  fd_sink_t(int fd, size_t capacity = 1 << 20) : fd(fd) {
+    buffer.reserve(capacity);
+  }
+
+  ~fd_sink_t() {
+    flush();
+  }
+
+  void write(const char* data, size_t size) override {
+    if (buffer.size() + size > buffer.capacity()) {
+      flush();
+      if (size > buffer.capacity()) return write_fd(fd, data, size);
+    }
+    buffer.insert(buffer.end(), data, data + size);
+  }
+
+  void flush() override {
+    write_fd(fd, buffer.data(), buffer.size());
+    buffer.clear();
+  }
+
+  using output_sink_t::write;
+
+ private:
+  int               fd;
+  std::vector<char> buffer;
+};
+
+struct memory_sink_t : output_sink_t {
+  void write(const char* data, size_t size) override {
+    buffer.append(data, size);
+  }
+
+  using output_sink_t::write;
+
+  const std::string& str() const {
+    return buffer;
+  }
+
+  void clear() {
+    buffer.clear();
+  }
+
+ private:
+  std::string buffer;
+};
+
+struct null_sink_t : output_sink_t {
+  void write(const char*, size_t) override { }
+
+  using output_sink_t::write;
+};
+
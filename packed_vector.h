@@ -0,0 +1,225 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+
+
+
+// Fixed-size array of numbers. Storage is aligned and padded to a cache
+// line, so full-width vector loads never cross the allocation.
+template <typename T>
+struct packed_array_t {
+  static constexpr size_t alignment = 64;
+
+  packed_array_t(size_t size = 0) : count(size), values(allocate(size)) {
+  }
+
+  size_t size() const {
+    return count;
+  }
+
+  T* data() {
+    return values.get();
+  }
+
+  const T* data() const {
+    return values.get();
+  }
+
+  T& operator[](size_t i) {
+    return values[i];
+  }
+
+  const T& operator[](size_t i) const {
+    return values[i];
+  }
+
+  // Drops the elements after 'size', the storage is kept.
+  void truncate(size_t size) {
+    if (size < count) count = size;
+  }
+
+ private:
+  struct free_t {
+    void operator()(T* ptr) const {
+      std::free(ptr);
+    }
+  };
+
+  static T* allocate(size_t size) {
+    if (!size) return nullptr;
+    size_t bytes = (size * sizeof(T) + alignment - 1) / alignment * alignment;
+    auto ret = static_cast<T*>(std::aligned_alloc(alignment, bytes));
+    if (!ret) throw std::bad_alloc();
+    return ret;
+  }
+
+  size_t                        count;
+  std::unique_ptr<T[], free_t>  values;
+};
+
+
+
+// Bulk kernels over packed arrays. Loops are written for the auto-vectorizer,
+// reductions use GCC vector types since floating point sums are not reordered
+// without -ffast-math. Every kernel is built for AVX2 and for the baseline,
+// the loader picks one by the CPU at startup.
+#define PACKED_KERNEL __attribute__((target_clones("avx2", "default")))
+
+enum class packed_op_t { add, sub, mul, less, equal, greater, sum, min, max };
+
+namespace packed_detail {
+
+  // One 256-bit register, two SSE registers in the baseline build.
+  template <typename T> struct lanes;
+  template <> struct lanes<int64_t> { typedef int64_t type __attribute__((vector_size(32))); };
+  template <> struct lanes<double>  { typedef double  type __attribute__((vector_size(32))); };
+
+  template <typename T>
+  using lanes_t = typename lanes<T>::type;
+
+  template <typename T>
+  [[gnu::always_inline]] inline void zip(packed_op_t op, T* out, const T* x, const T* y, size_t n) {
+    switch (op) {
+      case packed_op_t::add: for (size_t i = 0; i < n; i++) out[i] = x[i] + y[i]; break;
+      case packed_op_t::sub: for (size_t i = 0; i < n; i++) out[i] = x[i] - y[i]; break;
+      case packed_op_t::mul: for (size_t i = 0; i < n; i++) out[i] = x[i] * y[i]; break;
+      default: break;
+    }
+  }
+
+  template <typename T>
+  [[gnu::always_inline]] inline void compare(packed_op_t op, int64_t* out, const T* x, const T* y, size_t n) {
+    switch (op) {
+      case packed_op_t::less:    for (size_t i = 0; i < n; i++) out[i] = x[i] < y[i]; break;
+      case packed_op_t::equal:   for (size_t i = 0; i < n; i++) out[i] = x[i] == y[i]; break;
+      case packed_op_t::greater: for (size_t i = 0; i < n; i++) out[i] = x[i] > y[i]; break;
+      default: break;
+    }
+  }
+
+  // Four accumulators of one register each hide the latency of the adds.
+  template <packed_op_t op, typename T>
+  [[gnu::always_inline]] inline T reduce(const T* x, size_t n) {
+    constexpr size_t lanes = sizeof(lanes_t<T>) / sizeof(T);
+    T init = op == packed_op_t::sum ? T(0) : x[0];
+    lanes_t<T> acc[4];
+    for (auto& a : acc) {
+      a = lanes_t<T>{} + init;
+    }
+    size_t i = 0;
+    for (; i + 4 * lanes <= n; i += 4 * lanes) {
+      for (size_t k = 0; k < 4; k++) {
+        lanes_t<T> v;
+        std::memcpy(&v, x + i + k * lanes, sizeof(v));
+        if constexpr (op == packed_op_t::sum) acc[k] += v;
+        if constexpr (op == packed_op_t::min) acc[k] = v < acc[k] ? v : acc[k];
+        if constexpr (op == packed_op_t::max) acc[k] = v > acc[k] ? v : acc[k];
+      }
+    }
+    T ret = init;
+    for (; i < n; i++) {
+      if constexpr (op == packed_op_t::sum) ret += x[i];
+      if constexpr (op == packed_op_t::min) ret = x[i] < ret ? x[i] : ret;
+      if constexpr (op == packed_op_t::max) ret = x[i] > ret ? x[i] : ret;
+    }
+    for (size_t k = 0; k < 4; k++) {
+      for (size_t j = 0; j < lanes; j++) {
+        if constexpr (op == packed_op_t::sum) ret += acc[k][j];
+        if constexpr (op == packed_op_t::min) ret = acc[k][j] < ret ? acc[k][j] : ret;
+        if constexpr (op == packed_op_t::max) ret = acc[k][j] > ret ? acc[k][j] : ret;
+      }
+    }
+    return ret;
+  }
+
+  template <typename T>
+  [[gnu::always_inline]] inline T dot(const T* x, const T* y, size_t n) {
+    constexpr size_t lanes = sizeof(lanes_t<T>) / sizeof(T);
+    lanes_t<T> acc[4] = {};
+    size_t i = 0;
+    for (; i + 4 * lanes <= n; i += 4 * lanes) {
+      for (size_t k = 0; k < 4; k++) {
+        lanes_t<T> u, v;
+        std::memcpy(&u, x + i + k * lanes, sizeof(u));
+        std::memcpy(&v, y + i + k * lanes, sizeof(v));
+        acc[k] += u * v;
+      }
+    }
+    T ret = 0;
+    for (; i < n; i++) {
+      ret += x[i] * y[i];
+    }
+    for (size_t k = 0; k < 4; k++) {
+      for (size_t j = 0; j < lanes; j++) {
+        ret += acc[k][j];
+      }
+    }
+    return ret;
+  }
+
+  // Branchless compaction, the store is unconditional and the cursor moves on set lanes.
+  template <typename T>
+  [[gnu::always_inline]] inline size_t select(T* out, const T* x, const int64_t* mask, size_t n) {
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+      out[count] = x[i];
+      count += mask[i] != 0;
+    }
+    return count;
+  }
+
+}
+
+// out[i] = x[i] op y[i] for add, sub and mul.
+PACKED_KERNEL inline void packed_zip(packed_op_t op, int64_t* out, const int64_t* x, const int64_t* y, size_t n) {
+  packed_detail::zip(op, out, x, y, n);
+}
+
+PACKED_KERNEL inline void packed_zip(packed_op_t op, double* out, const double* x, const double* y, size_t n) {
+  packed_detail::zip(op, out, x, y, n);
+}
+
+// out[i] = 1 when x[i] op y[i] holds for less, equal and greater, 0 otherwise.
+PACKED_KERNEL inline void packed_compare(packed_op_t op, int64_t* out, const int64_t* x, const int64_t* y, size_t n) {
+  packed_detail::compare(op, out, x, y, n);
+}
+
+PACKED_KERNEL inline void packed_compare(packed_op_t op, int64_t* out, const double* x, const double* y, size_t n) {
+  packed_detail::compare(op, out, x, y, n);
+}
+
+// sum, min or max; min and max need n > 0. Doubles are summed in a
+// different order than a sequential loop, the last bits may differ.
+PACKED_KERNEL inline int64_t packed_reduce(packed_op_t op, const int64_t* x, size_t n) {
+  if (op == packed_op_t::min) return packed_detail::reduce<packed_op_t::min>(x, n);
+  if (op == packed_op_t::max) return packed_detail::reduce<packed_op_t::max>(x, n);
+  return packed_detail::reduce<packed_op_t::sum>(x, n);
+}
+
+PACKED_KERNEL inline double packed_reduce(packed_op_t op, const double* x, size_t n) {
+  if (op == packed_op_t::min) return packed_detail::reduce<packed_op_t::min>(x, n);
+  if (op == packed_op_t::max) return packed_detail::reduce<packed_op_t::max>(x, n);
+  return packed_detail::reduce<packed_op_t::sum>(x, n);
+}
+
+PACKED_KERNEL inline int64_t packed_dot(const int64_t* x, const int64_t* y, size_t n) {
+  return packed_detail::dot(x, y, n);
+}
+
+PACKED_KERNEL inline double packed_dot(const double* x, const double* y, size_t n) {
+  return packed_detail::dot(x, y, n);
+}
+
+// Copies x[i] with a non-zero mask[i] to out, returns the count. out holds n elements.
+PACKED_KERNEL inline size_t packed_select(int64_t* out, const int64_t* x, const int64_t* mask, size_t n) {
+  return packed_detail::select(out, x, mask, n);
+}
+
+PACKED_KERNEL inline size_t packed_select(double* out, const double* x, const int64_t* mask, size_t n) {
+  return packed_detail::select(out, x, mask, n);
+}
+
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+
+// Call profiler. Functions are identified by an opaque shared key, costs are
+// attributed to a call tree, so flat totals and collapsed stacks come
+// from the same data. Keys are held until reset(), so the address of a
+// freed function can't be reused by another one.
+struct profiler_t {
+  struct function_t {
+    std::string                 name;
+    std::shared_ptr<const void> key;
+    uint64_t                    calls      = 0;
+    uint64_t                    evals_incl = 0;
+    uint64_t                    evals_excl = 0;
+    uint64_t                    ns_incl    = 0;
+    uint64_t                    ns_excl    = 0;
+    size_t                      active     = 0; // recursion depth, inclusive costs are counted once
+  };
+
+  struct node_t {
+    size_t                             function;
+    size_t                             parent;
+    uint64_t                           ns_excl = 0;
+    std::unordered_map<size_t, size_t> children;
+  };
+
+  struct frame_t {
+    size_t   node;
+    uint64_t start_ns;
+    uint64_t start_evals;
+    uint64_t child_ns    = 0;
+    uint64_t child_evals = 0;
+  };
+
+  // Enter/exit pair, does nothing without a profiler.
+  struct scope_t {
+    template <typename K, typename F>
+    scope_t(profiler_t* profiler, const std::shared_ptr<K>& key, F name, const size_t& evals)
+        : profiler(profiler), evals(evals) {
+      if (profiler) profiler->enter(key, name, evals);
+    }
+
+    ~scope_t() {
+      if (profiler) profiler->exit(evals);
+    }
+
+   private:
+    profiler_t*   profiler;
+    const size_t& evals;
+  };
+
+  profiler_t() {
+    reset();
+  }
+
+  void reset() {
+    ids.clear();
+    functions.clear();
+    nodes.assign(1, node_t{0, 0, 0, {}});
+    stack.clear();
+  }
+
+  template <typename K, typename F>
+  void enter(const std::shared_ptr<K>& key, F name, uint64_t evals) {
+    auto [it, inserted] = ids.try_emplace(key.get(), functions.size());
+    if (inserted) functions.push_back({name(), key});
+
+    size_t parent = stack.empty() ? 0 : stack.back().node;
+    auto [child, added] = nodes[parent].children.try_emplace(it->second, nodes.size());
+    size_t node = child->second;
+    if (added) nodes.push_back(node_t{it->second, parent, 0, {}});
+
+    functions[it->second].active++;
+    stack.push_back({node, now(), evals});
+  }
+
+  void exit(uint64_t evals) {
+    auto frame = stack.back();
+    stack.pop_back();
+
+    uint64_t ns = now() - frame.start_ns;
+    uint64_t evals_incl = evals - frame.start_evals;
+    auto& node = nodes[frame.node];
+    auto& function = functions[node.function];
+
+    function.calls++;
+    function.active--;
+    function.ns_excl += ns - frame.child_ns;
+    function.evals_excl += evals_incl - frame.child_evals;
+    if (!function.active) {
+      function.ns_incl += ns;
+      function.evals_incl += evals_incl;
+    }
+    node.ns_excl += ns - frame.child_ns;
+
+    if (!stack.empty()) {
+      stack.back().child_ns += ns;
+      stack.back().child_evals += evals_incl;
+    }
+  }
+
+  // Top functions by exclusive time.
+  void show_top(std::ostream& os, size_t count) const {
+    std::vector<const function_t*> sorted;
+    for (const auto& function : functions) {
+      sorted.push_back(&function);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](auto x, auto y) { return x->ns_excl > y->ns_excl; });
+    if (sorted.size() > count) sorted.resize(count);
+
+    os << "calls\tevals_incl\tevals_excl\tns_incl\tns_excl\tname\n";
+    for (auto function : sorted) {
+      os << function->calls << '\t' << function->evals_incl << '\t' << function->evals_excl << '\t'
+        << function->ns_incl << '\t' << function->ns_excl << '\t' << function->name << '\n';
+    }
+  }
+
+  // One line per call path: "f;g;h <ns>", the input format of flamegraph.pl.
+  void show_collapsed(std::ostream& os) const {
+    std::vector<std::pair<size_t, std::string>> work;
+    for (const auto& kv : nodes[0].children) {
+      work.push_back({kv.second, functions[kv.first].name});
+    }
+    while (!work.empty()) {
+      auto [index, path] = work.back();
+      work.pop_back();
+      const auto& node = nodes[index];
+      if (node.ns_excl) os << path << ' ' << node.ns_excl << '\n';
+      for (const auto& kv : node.children) {
+        work.push_back({kv.second, path + ';' + functions[kv.first].name});
+      }
+    }
+  }
+
+ private:
+  static uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  std::unordered_map<const void*, size_t> ids;
+  std::vector<function_t>                 functions;
+  std::vector<node_t>                     nodes; // nodes[0] is the root
+  std::vector<frame_t>                    stack;
+};
+
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+
+
+// Byte scanners for string primitives and the parser. On x86-64 each one is
+// built twice, SSE2 for the baseline and AVX2, and the loader picks one by the
+// CPU (function multiversioning). Tails and other targets use the scalar loops.
+
+// Bytes in [lo, hi] except up to three, the rest stop a scan_class_end().
+struct byte_class_t {
+  char lo;
+  char hi;
+  char except[3]; // repeat one to use fewer
+
+  bool contains(char c) const {
+    return c >= lo && c <= hi && c != except[0] && c != except[1] && c != except[2];
+  }
+};
+
+namespace scan_detail {
+
+  inline size_t find(const char* p, size_t n, char c, size_t i) {
+    for (; i < n; i++) {
+      if (p[i] == c) return i;
+    }
+    return n;
+  }
+
+  inline size_t count(const char* p, size_t n, char c, size_t i) {
+    size_t ret = 0;
+    for (; i < n; i++) {
+      ret += p[i] == c;
+    }
+    return ret;
+  }
+
+  inline size_t find_str(const char* p, size_t n, std::string_view needle, size_t i) {
+    auto pos = std::string_view(p, n).find(needle, i);
+    return pos == std::string_view::npos ? n : pos;
+  }
+
+  inline size_t class_end(const char* p, size_t n, const byte_class_t& cls, size_t i) {
+    for (; i < n; i++) {
+      if (!cls.contains(p[i])) return i;
+    }
+    return n;
+  }
+
+}
+
+#if defined(__x86_64__)
+
+#define SCAN_SSE2 __attribute__((target("default")))
+#define SCAN_AVX2 __attribute__((target("avx2")))
+
+// Index of the first 'c', n when there is none.
+SCAN_SSE2 inline size_t scan_find(const char* p, size_t n, char c) {
+  size_t i = 0;
+  auto v = _mm_set1_epi8(c);
+  for (; i + 16 <= n; i += 16) {
+    auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+    if (unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, v))) return i + __builtin_ctz(mask);
+  }
+  return scan_detail::find(p, n, c, i);
+}
+
+SCAN_AVX2 inline size_t scan_find(const char* p, size_t n, char c) {
+  size_t i = 0;
+  auto v = _mm256_set1_epi8(c);
+  for (; i + 32 <= n; i += 32) {
+    auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+    if (unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, v))) return i + __builtin_ctz(mask);
+  }
+  return scan_detail::find(p, n, c, i);
+}
+
+// Number of 'c'. Matches are summed in byte lanes and widened every 255 blocks.
+SCAN_SSE2 inline size_t scan_count(const char* p, size_t n, char c) {
+  size_t ret = 0;
+  size_t i = 0;
+  auto v = _mm_set1_epi8(c);
+  auto zero = _mm_setzero_si128();
+  while (i + 16 <= n) {
+    auto acc = zero;
+    for (size_t k = 0; k < 255 && i + 16 <= n; k++, i += 16) {
+      auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+      acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(x, v));
+    }
+    auto sum = _mm_sad_epu8(acc, zero);
+    ret += _mm_cvtsi128_si64(sum) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(sum, sum));
+  }
+  return ret + scan_detail::count(p, n, c, i);
+}
+
+SCAN_AVX2 inline size_t scan_count(const char* p, size_t n, char c) {
+  size_t ret = 0;
+  size_t i = 0;
+  auto v = _mm256_set1_epi8(c);
+  auto zero = _mm256_setzero_si256();
+  while (i + 32 <= n) {
+    auto acc = zero;
+    for (size_t k = 0; k < 255 && i + 32 <= n; k++, i += 32) {
+      auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+      acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(x, v));
+    }
+    auto sum = _mm256_sad_epu8(acc, zero);
+    ret += _mm256_extract_epi64(sum, 0) + _mm256_extract_epi64(sum, 1)
+         + _mm256_extract_epi64(sum, 2) + _mm256_extract_epi64(sum, 3);
+  }
+  return ret + scan_detail::count(p, n, c, i);
+}
+
+// Index of the first 'needle' at or after 'from', n when there is none.
+// Blocks are filtered on the first and the last byte of the needle, the
+// candidates are compared in full.
+SCAN_SSE2 inline size_t scan_find_str(const char* p, size_t n, std::string_view needle, size_t from = 0) {
+  size_t m = needle.size();
+  if (m == 1 && from < n) return from + scan_find(p + from, n - from, needle.front());
+  if (m < 2 || m > n) return scan_detail::find_str(p, n, needle, from);
+  size_t i = from;
+  auto first = _mm_set1_epi8(needle.front());
+  auto last = _mm_set1_epi8(needle.back());
+  for (; i + m - 1 + 16 <= n; i += 16) {
+    auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+    auto y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + m - 1));
+    unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(x, first), _mm_cmpeq_epi8(y, last)));
+    for (; mask; mask &= mask - 1) {
+      size_t pos = i + __builtin_ctz(mask);
+      if (!std::memcmp(p + pos + 1, needle.data() + 1, m - 2)) return pos;
+    }
+  }
+  return scan_detail::find_str(p, n, needle, i);
+}
+
+SCAN_AVX2 inline size_t scan_find_str(const char* p, size_t n, std::string_view needle, size_t from = 0) {
+  size_t m = needle.size();
+  if (m == 1 && from < n) return from + scan_find(p + from, n - from, needle.front());
+  if (m < 2 || m > n) return scan_detail::find_str(p, n, needle, from);
+  size_t i = from;
+  auto first = _mm256_set1_epi8(needle.front());
+  auto last = _mm256_set1_epi8(needle.back());
+  for (; i + m - 1 + 32 <= n; i += 32) {
+    auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+    auto y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i + m - 1));
+    unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(x, first), _mm256_cmpeq_epi8(y, last)));
+    for (; mask; mask &= mask - 1) {
+      size_t pos = i + __builtin_ctz(mask);
+      if (!std::memcmp(p + pos + 1, needle.data() + 1, m - 2)) return pos;
+    }
+  }
+  return scan_detail::find_str(p, n, needle, i);
+}
+
+// Index of the first byte outside 'cls', n when there is none. lo and hi are
+// ASCII, so bytes from 0x80 compare below lo as signed chars.
+SCAN_SSE2 inline size_t scan_class_end(const char* p, size_t n, const byte_class_t& cls) {
+  size_t i = 0;
+  auto lo = _mm_set1_epi8(cls.lo);
+  auto hi = _mm_set1_epi8(cls.hi);
+  auto e0 = _mm_set1_epi8(cls.except[0]);
+  auto e1 = _mm_set1_epi8(cls.except[1]);
+  auto e2 = _mm_set1_epi8(cls.except[2]);
+  for (; i + 16 <= n; i += 16) {
+    auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+    auto stop = _mm_or_si128(_mm_cmpgt_epi8(lo, x), _mm_cmpgt_epi8(x, hi));
+    stop = _mm_or_si128(stop, _mm_or_si128(_mm_cmpeq_epi8(x, e0), _mm_or_si128(_mm_cmpeq_epi8(x, e1), _mm_cmpeq_epi8(x, e2))));
+    if (unsigned mask = _mm_movemask_epi8(stop)) return i + __builtin_ctz(mask);
+  }
+  return scan_detail::class_end(p, n, cls, i);
+}
+
+SCAN_AVX2 inline size_t scan_class_end(const char* p, size_t n, const byte_class_t& cls) {
+  size_t i = 0;
+  auto lo = _mm256_set1_epi8(cls.lo);
+  auto hi = _mm256_set1_epi8(cls.hi);
+  auto e0 = _mm256_set1_epi8(cls.except[0]);
+  auto e1 = _mm256_set1_epi8(cls.except[1]);
+  auto e2 = _mm256_set1_epi8(cls.except[2]);
+  for (; i + 32 <= n; i += 32) {
+    auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+    auto stop = _mm256_or_si256(_mm256_cmpgt_epi8(lo, x), _mm256_cmpgt_epi8(x, hi));
+    stop = _mm256_or_si256(stop, _mm256_or_si256(_mm256_cmpeq_epi8(x, e0), _mm256_or_si256(_mm256_cmpeq_epi8(x, e1), _mm256_cmpeq_epi8(x, e2))));
+    if (unsigned mask = _mm256_movemask_epi8(stop)) return i + __builtin_ctz(mask);
+  }
+  return scan_detail::class_end(p, n, cls, i);
+}
+
+#else
+
+inline size_t scan_find(const char* p, size_t n, char c) {
+  return scan_detail::find(p, n, c, 0);
+}
+
+inline size_t scan_count(const char* p, size_t n, char c) {
+  return scan_detail::count(p, n, c, 0);
+}
+
+inline size_t scan_find_str(const char* p, size_t n, std::string_view needle, size_t from = 0) {
+  return scan_detail::find_str(p, n, needle, from);
+}
+
+inline size_t scan_class_end(const char* p, size_t n, const byte_class_t& cls) {
+  return scan_detail::class_end(p, n, cls, 0);
+}
+
+#endif
+
@@ -0,0 +1,643 @@
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+
+#include <fcntl.h>
+
+#include "lisp_interpreter.h"
+
+
+
+namespace {
+
+  using namespace lisp_interpreter;
+
+  // 'expected' is the printed result of the last form, or "error: " and a
+  // part of the message when evaluation throws.
+  struct case_t {
+    std::string name;
+    std::string code;
+    std::string expected;
+  };
+
+  std::vector<case_t> cases() {
+    return {
+      // parser errors with line:column
+      {"parse_unclosed",    "(list\n  (a b", "error: '(' at 2:3 is not closed"},
+      {"parse_extra_paren", "(+ 1 2))", "error: unexpected ')' at 1:8"},
+      {"parse_string_eof",  "(println \"abc)", "error: unexpected EOF in string at 1:10"},
+      {"parse_bad_number",  "(+ 1 1.2.3)", "error: invalid number '1.2.3' at 1:6"},
+      {"parse_bad_int",     "(+ 1\n 99999999999999999999)", "error: invalid number '99999999999999999999' at 2:2"},
+
+      // seqs and the standard macros as functions
+      {"foldl_macro",       "(foldl + 0 (range 0 10))", "45"},
+      {"foldl_lambda",      "(foldl (lambda (x acc) (+ x acc)) 0 (map (lambda (x) (* x 2)) (range 0 10)))", "90"},
+      {"map_macro",         "(def inc (macro (x) (+ x 1))) (foldl cons () (map inc (quote (1 2))))", "(3 2)"},
+      {"filter_macro",      "(foldl cons () (filter nil? (quote (1 () 2))))", "(())"},
+      {"foldl_as_value",    "(def f foldl) (f + 0 (range 0 4))", "6"},
+      {"print_range",       "(range 0 3)", "(0 1 2)"},
+      {"print_range_empty", "(range 3 3)", "()"},
+      {"print_filter",      "(filter (lambda (x) (less? x 3)) (range 0 10))", "(0 1 2)"},
+      {"print_cons_seq",    "(cons 9 (range 0 2))", "(9 0 1)"},
+      {"print_nested_seq",  "(cons (range 0 2) (cons (map (lambda (x) (* x x)) (range 1 4)) ()))", "((0 1) (1 4 9))"},
+      {"foldl_not_function", "(foldl 1 0 (range 0 4))", "error: argument #1 is not function"},
+
+      // hash-consing
+      {"hashcons_equal",    "(hash-consing true) (def a (cons 1 (cons 2 ()))) (def b (cons 1 (cons 2 ()))) (equal? a b)", "true"},
+      {"hashcons_differ",   "(hash-consing true) (def a (cons 1 (cons 2 ()))) (def b (cons 1 (cons 3 ()))) (equal? a b)", "false"},
+      {"hashcons_toggled",  "(hash-consing true) (def a (cons 1 (cons 2 ()))) (hash-consing false) (hash-consing true) (def b (cons 1 (cons 2 ()))) (equal? a b)", "true"},
+      {"hashcons_one_side", "(def a (cons 1 (cons 2 ()))) (hash-consing true) (def b (cons 1 (cons 2 ()))) (equal? a b)", "true"},
+      {"hashcons_plain_tail", "(def t (cons 2 ())) (hash-consing true) (def a (cons 1 t)) (def b (cons 1 (cons 2 ()))) (equal? a b)", "true"},
+      {"hashcons_map_off",  "(equal? (cons (to-map (quote ((1 2)))) ()) (cons (to-map (quote ((1 2)))) ()))", "true"},
+      {"hashcons_map_on",   "(hash-consing true) (equal? (cons (to-map (quote ((1 2)))) ()) (cons (to-map (quote ((1 2)))) ()))", "true"},
+      {"hashcons_vec_on",   "(hash-consing true) (equal? (cons 0 (cons (vec (range 0 3)) ())) (cons 0 (cons (vec (range 0 3)) ())))", "true"},
+      {"hashcons_strings",  "(hash-consing true) (def a (cons \"x\" ())) (hash-consing false) (def b (cons \"x\" ())) (equal? a b)", "true"},
+
+      // lazy defs
+      {"lazy_def_returns_name", "(lazy-defs true) (def y (+ 1 2))", "y"},
+      {"lazy_def_value",    "(lazy-defs true) (def y (+ 1 2)) y", "3"},
+      {"lazy_def_call",     "(lazy-defs true) (def sq (lambda (x) (* x x))) (sq 7)", "49"},
+      {"lazy_def_error",    "(lazy-defs true) (def broken (head ())) broken", "error: lazy def 'broken' at 1:31"},
+      {"lazy_def_cycle",    "(lazy-defs true) (def loop (+ loop 1)) loop", "error: depends on itself"},
+      {"lazy_def_in_lambda", "(lazy-defs true) (def g (lambda () (def z (+ 1 2)))) (g)", "3"},
+      {"lazy_def_off",      "(lazy-defs true) (lazy-defs false) (def y (+ 1 2))", "3"},
+
+      // doubles print in the shortest form that reads back, always with a '.' or exponent
+      {"double_whole",      "(+ 0.5 0.5)", "1.0"},
+      {"double_shortest",   "(* 0.1 3.0)", "0.30000000000000004"},
+      {"double_negative",   "(- 0.0 2.5)", "-2.5"},
+
+      // files
+      {"open_missing",      "(open \"/nonexistent/lisp_tests\" \"r\")", "error: is not readable"},
+      {"open_bad_mode",     "(open \"/tmp/lisp_tests.mode\" \"x\")", "error: unknown mode 'x'"},
+      {"read_line_not_file", "(read-line 1)", "error: is not file opened for reading"},
+
+      // maps
+      {"map_get",           "(get (assoc (to-map ()) \"k\" 1) \"k\")", "1"},
+      {"map_get_or",        "(get-or (to-map ()) 1 \"none\")", "\"none\""},
+      {"map_dissoc",        "(contains? (dissoc (to-map (quote ((1 2) (3 4)))) 1) 1)", "false"},
+      {"map_persistent",    "(def m (to-map (quote ((1 2))))) (def n (assoc m 1 5)) (cons (get m 1) (cons (get n 1) ()))", "(2 5)"},
+      {"map_size",          "(size (to-map (quote ((1 2) (3 4) (1 5)))))", "2"},
+      {"map_print_seq",     "(assoc (to-map ()) 1 (range 0 2))", "{1 (0 1)}"},
+      {"map_equal",         "(equal? (assoc (assoc (to-map ()) 1 2) \"k\" (quote (3))) (assoc (assoc (to-map ()) \"k\" (quote (3))) 1 2))", "true"},
+      {"map_not_equal",     "(equal? (assoc (to-map ()) 1 2) (assoc (to-map ()) 1 3))", "false"},
+      {"map_equal_nested",  "(equal? (cons (to-map (quote ((1 2) (3 4)))) ()) (cons (to-map (quote ((3 4) (1 2)))) ()))", "true"},
+      {"map_hash",          "(equal? (hash (to-map (quote ((1 2) (3 4))))) (hash (to-map (quote ((3 4) (1 2))))))", "true"},
+
+      // packed vectors
+      {"vec_print",         "(vec (range 0 4))", "[0 1 2 3]"},
+      {"vec_sum",           "(vec-sum (vec (range 0 100)))", "4950"},
+      {"vec_add_scalar",    "(vec-add (vec (range 0 3)) 10)", "[10 11 12]"},
+      {"vec_promote",       "(vec-mul (vec (range 1 3)) 0.5)", "[0.5 1.0]"},
+      {"vec_select",        "(def v (vec (range 0 6))) (vec-select v (vec-less v 3))", "[0 1 2]"},
+      {"vec_dot",           "(def v (vec (range 0 4))) (vec-dot v v)", "14"},
+      {"vec_min_empty",     "(vec-min (vec ()))", "error: eval_vec_min: vec is empty"},
+      {"vec_equal",         "(equal? (vec (range 0 3)) (vec (quote (0 1 2))))", "true"},
+      {"vec_equal_nested",  "(equal? (cons (vec (range 0 3)) ()) (cons (vec (range 0 3)) ()))", "true"},
+      {"vec_not_equal",     "(equal? (vec (range 0 3)) (vec (range 0 4)))", "false"},
+      {"vec_equal_types",   "(equal? (vec (quote (1 2))) (vec (quote (1.0 2.0))))", "false"},
+
+      // string primitives
+      {"string_find",       "(string-find \"a,b,c\" \",c\")", "3"},
+      {"string_find_miss",  "(string-find \"abc\" \"x\")", "-1"},
+      {"string_find_from",  "(string-find-from \"a,b,c\" \",\" 2)", "3"},
+      {"string_count",      "(string-count \"a,b,,c\" \",\")", "3"},
+      {"string_split",      "(string-split \"a,b,,c\" \",\")", "(\"a\" \"b\" \"\" \"c\")"},
+      {"string_replace",    "(string-replace \"a-b-c\" \"-\" \"+\")", "\"a+b+c\""},
+      {"substring",         "(substring \"hello world\" 6 11)", "\"world\""},
+      {"string_length",     "(string-length (string-drop \"hello\" 2))", "3"},
+
+      // ropes, made by + of strings longer than 64 bytes together
+      {"rope_equal_flat",   "(def r (+ \"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\" \"bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb\")) (equal? r \"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaabbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb\")", "true"},
+      {"rope_equal_rope",   "(def s \"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaabbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb\") (equal? (+ \"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\" \"bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb\") (+ (substring s 0 50) (substring s 50 80)))", "true"},
+      {"rope_differ_rope",  "(def s \"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaabbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbc\") (equal? (+ \"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\" \"bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb\") (+ (substring s 0 50) (substring s 50 81)))", "false"},
+      {"rope_less_flat",    "(less? (+ \"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\" \"bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb\") \"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaabbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbc\")", "true"},
+      {"flat_less_rope",    "(less? \"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaabbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb\" (+ \"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\" \"bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb\"))", "true"},
+      {"rope_flattened",    "(def r (+ \"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\" \"bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb\")) (hash r) (cons (string-length r) (cons (substring r 38 42) (cons (equal? r (+ (substring r 0 10) (substring r 10 80))) ())))", "(80 \"aabb\" true)"},
+      {"rope_not_less_prefix", "(less? (+ \"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\" \"bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbb\") \"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\")", "false"},
+
+      // modules
+      {"load_twice",        "(load \"standart.lispam\") (load \"standart.lispam\") (+ 1 2)", "3"},
+      {"load_missing",      "(load \"/nonexistent/lisp_tests.lispam\")", "error: is not exists"},
+    };
+  }
+
+  // An env with the library loaded.
+  env_sptr_t library(context_t& ctx) {
+    auto env = std::make_shared<env_t>();
+    object_t::parse("(__kernel_load \"standart.lispam\")")->eval(env, ctx);
+    return env;
+  }
+
+  // Each case runs in a new interpreter, println output is dropped.
+  bool run(const case_t& c) {
+    null_sink_t out;
+    interpreter_t interpreter("standart.lispam");
+    interpreter.set_output(out);
+    std::string actual;
+    try {
+      actual = interpreter.show(interpreter.eval(c.code));
+    } catch (const std::exception& e) {
+      actual = "error: "s + e.what();
+    }
+
+    bool ok = c.expected.starts_with("error: ") ? actual.starts_with("error: ") && actual.find(c.expected.substr(7)) != std::string::npos
+                                                : actual == c.expected;
+    if (!ok) {
+      std::cout << "FAIL " << c.name << "\n  code:     " << c.code << "\n  expected: " << c.expected
+        << "\n  actual:   " << actual << std::endl;
+    }
+    return ok;
+  }
+
+  bool check(const char* name, bool ok) {
+    if (!ok) std::cout << "FAIL " << name << std::endl;
+    return ok;
+  }
+
+  std::string temp_path(const char* name) {
+    return (std::filesystem::temp_directory_path() / name).string();
+  }
+
+  void write_file(const std::string& path, std::string_view text) {
+    std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+    ofs << text;
+  }
+
+  // A module is evaluated once, and again when its file changes.
+  bool module_reload() {
+    auto path = temp_path("lisp_tests_module.lispam");
+    write_file(path, "(def counter 1) (println \"loaded\")");
+    context_t ctx;
+    auto env = library(ctx);
+    auto load = object_t::parse("(load \"" + path + "\")");
+    load->eval(env, ctx);
+    load->eval(env, ctx);
+    bool ok = ctx.stream.str() == "\"loaded\"\n" && object_t::parse("counter")->eval(env, ctx)->show() == "1";
+
+    write_file(path, "(def counter 22) (println \"reloaded\")");
+    load->eval(env, ctx);
+    ok = ok && ctx.stream.str() == "\"loaded\"\n\"reloaded\"\n" && object_t::parse("counter")->eval(env, ctx)->show() == "22";
+    std::filesystem::remove(path);
+    return check("module_reload", ok);
+  }
+
+  // A module whose defs clash with existing values is rejected before it runs.
+  bool module_clash() {
+    auto path = temp_path("lisp_tests_clash.lispam");
+    write_file(path, "(println \"loaded\") (def counter 2)");
+    context_t ctx;
+    auto env = library(ctx);
+    object_t::parse("(def counter 1)")->eval(env, ctx);
+    std::string error;
+    try {
+      object_t::parse("(load \"" + path + "\")")->eval(env, ctx);
+    } catch (const std::exception& e) {
+      error = e.what();
+    }
+    bool ok = error.find("value 'counter' is exists") != std::string::npos && ctx.stream.str().empty()
+      && object_t::parse("counter")->eval(env, ctx)->show() == "1";
+    std::filesystem::remove(path);
+    return check("module_clash", ok);
+  }
+
+  // Input fed byte by byte parses to the same forms as in one piece.
+  bool parse_chunked() {
+    std::string_view code = "(def s \"a b ; c\") ; comment (\n(list -12 3.5 -x - 'q (nested ()))\n\"tail\" 42";
+    parser_t whole;
+    whole.feed(code);
+    parser_t bytes;
+    for (size_t i = 0; i < code.size(); i++) {
+      bytes.feed(code.substr(i, 1));
+    }
+    auto x = whole.finish()->show();
+    auto y = bytes.finish()->show();
+    return check("parse_chunked", x == y && x == "((def s \"a b ; c\") (list -12 3.5 -x - 'q (nested ())) \"tail\" 42)");
+  }
+
+  // Nesting deeper than the call stack allows is parsed, printed, hashed and freed.
+  bool deep_nesting() {
+    size_t depth = 200000;
+    interpreter_t interpreter("standart.lispam");
+    auto hash = interpreter.eval("(hash (quote " + std::string(depth, '(') + std::string(depth, ')') + "))");
+    auto nested = object_t::parse(std::string(depth, '(') + "1" + std::string(depth, ')'));
+    bool ok = nested->show().size() == depth * 2 + 1 && std::stoll(hash->show()) != 0;
+    nested = nullptr;
+    return check("deep_nesting", ok);
+  }
+
+  // Lists deeper than 'depth' print as (...), elements past 'length' as "...".
+  bool print_limits() {
+    auto object = object_t::parse("(1 (2 (3 (4 5))) 6 7 8)");
+    bool ok = object->show() == "(1 (2 (3 (4 5))) 6 7 8)"
+      && object->show({2, 3}) == "(1 (2 (...)) 6 ...)"
+      && object->show({0, 3}) == "(...)"
+      && object->show({SIZE_MAX, 5}) == "(1 (2 (3 (4 5))) 6 7 8)";
+    std::string long_list = "(";
+    for (int i = 0; i < 100; i++) long_list += std::to_string(i) + " ";
+    long_list.back() = ')';
+    ok = ok && object_t::parse(long_list)->show(print_brief) == "(0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 ...)";
+    return check("print_limits", ok);
+  }
+
+  // Printing shows only the cells of a seq that are forced, realize forces them
+  // first, up to the limits; user code runs and prints there.
+  bool print_seq() {
+    context_t ctx;
+    auto env = library(ctx);
+    memory_sink_t out;
+    ctx.out = &out;
+    auto eval = [&env, &ctx](const char* code) { return object_t::parse(code)->eval(env, ctx); };
+    auto seq = eval("(map (lambda (x) (println x)) (range 0 3))");
+    bool ok = seq->show() == "#<seq>" && out.str().empty();
+    seq->realize(ctx);
+    ok = ok && seq->show() == "(true true true)" && out.str() == "0\n1\n2\n";
+
+    auto range = eval("(range 0 5)");
+    range->realize(ctx, {SIZE_MAX, 2});
+    ok = ok && range->show({SIZE_MAX, 2}) == "(0 1 ...)" && range->show() == "(0 1 2 . #<seq>)";
+    auto big = eval("(range 0 1000000000000)");
+    big->realize(ctx, print_brief);
+    ok = ok && big->show(print_brief) == "(0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 ...)";
+    return check("print_seq", ok);
+  }
+
+  // A seq bound to a name runs its stages once, however many consumers read
+  // it; a seq made from it reuses its cells.
+  bool seq_shared() {
+    memory_sink_t out;
+    interpreter_t interpreter("standart.lispam");
+    interpreter.set_output(out);
+    auto count = "(foldl (lambda (x acc) (+ acc 1)) 0 xs)";
+    interpreter.eval("(def xs (map (lambda (x) (println x)) (range 0 3)))");
+    bool ok = interpreter.eval(count)->show() == "3" && interpreter.eval(count)->show() == "3"
+      && interpreter.eval("(foldl (lambda (x acc) (+ acc 1)) 0 (filter (lambda (x) x) xs))")->show() == "3"
+      && out.str() == "0\n1\n2\n";
+    interpreter.eval("(foldl (lambda (x acc) acc) 0 (map (lambda (x) (println x)) (range 0 2)))");
+    return check("seq_shared", ok && out.str() == "0\n1\n2\n0\n1\n");
+  }
+
+  // load-data returns the forms of a file without evaluating them.
+  bool load_data_forms() {
+    auto path = temp_path("lisp_tests_data.lispam");
+    write_file(path, "(def x 1)\n(1 \"row\" -1.5)\n");
+    context_t ctx;
+    auto env = library(ctx);
+    auto data = object_t::parse("(__kernel_load_data \"" + path + "\")")->eval(env, ctx);
+    bool ok = data->show() == "((def x 1) (1 \"row\" -1.5))" && !env->findvar("x");
+    std::filesystem::remove(path);
+    return check("load_data_forms", ok);
+  }
+
+  // Calls are counted per named lambda or macro, collapsed stacks list callers first.
+  bool profiler_output() {
+    profiler_t profiler;
+    context_t ctx;
+    auto env = library(ctx);
+    ctx.profiler = &profiler;
+    for (auto form : {"(def sq (lambda (x) (* x x)))", "(def sum-sq (lambda (a b) (+ (sq a) (sq b))))", "(sum-sq 3 4)"}) {
+      object_t::parse(form)->eval(env, ctx);
+    }
+
+    std::ostringstream top, flame;
+    profiler.show_top(top, 100);
+    profiler.show_collapsed(flame);
+    std::map<std::string, std::string> calls; // name without the location
+    std::istringstream lines(top.str());
+    for (std::string line; std::getline(lines, line); ) {
+      auto name = line.substr(line.rfind('\t') + 1);
+      calls[name.substr(0, name.find('@'))] = line.substr(0, line.find('\t'));
+    }
+    bool ok = top.str().starts_with("calls\tevals_incl\tevals_excl\tns_incl\tns_excl\tname\n")
+      && calls["sq"] == "2" && calls["sum-sq"] == "1" && calls["*"] == "2"
+      && flame.str().find("\nsum-sq@1:28;+@") != std::string::npos && flame.str().find(";sq@1:22;*@") != std::string::npos;
+    return check("profiler_output", ok);
+  }
+
+  // A function allocated where a freed one was is still counted on its own.
+  bool profiler_reused_address() {
+    profiler_t profiler;
+    size_t evals = 0;
+    auto first = std::make_shared<int64_t>(1);
+    { profiler_t::scope_t scope(&profiler, first, [] { return "first"; }, evals); }
+    first = nullptr;
+    auto second = std::make_shared<int64_t>(2);
+    { profiler_t::scope_t scope(&profiler, second, [] { return "second"; }, evals); }
+
+    std::ostringstream top;
+    profiler.show_top(top, SIZE_MAX);
+    std::map<std::string, std::string> calls;
+    std::istringstream lines(top.str());
+    for (std::string line; std::getline(lines, line); ) {
+      calls[line.substr(line.rfind('\t') + 1)] = line.substr(0, line.find('\t'));
+    }
+    return check("profiler_reused_address", calls["first"] == "1" && calls["second"] == "1");
+  }
+
+  // Macro expansion counts no exceptions, both formats report the same counters.
+  bool metrics_output() {
+    context_t ctx;
+    auto env = library(ctx);
+    auto exceptions = runtime_stats.exceptions();
+    object_sptr_t code;
+    {
+      LOG_DURATION(ctx.metrics.time_parse);
+      code = object_t::parse("(def sq (lambda (x) (* x x))) (sq 3)");
+    }
+    {
+      LOG_DURATION(ctx.metrics.time_eval);
+      code->eval(env, ctx);
+    }
+    const auto& metrics = ctx.metrics;
+    bool ok = runtime_stats.exceptions() == exceptions && metrics.macro_expansions > 0
+      && metrics.time_eval > 0 && metrics.time_parse > 0;
+
+    std::ostringstream json, prometheus;
+    metrics.show_json(json);
+    metrics.show_prometheus(prometheus);
+    auto macros = std::to_string(metrics.macro_expansions);
+    ok = ok && json.str().starts_with("{\"eval_calls\": " + std::to_string(metrics.eval_calls) + ", ")
+      && json.str().find("\"macro_expansions\": " + macros + ", ") != std::string::npos
+      && json.str().find("\"allocations\": {") != std::string::npos && json.str().ends_with("}}")
+      && prometheus.str().find("# TYPE lisp_macro_expansions_total counter\nlisp_macro_expansions_total " + macros + "\n") != std::string::npos
+      && prometheus.str().find("# TYPE lisp_objects_live gauge\n") != std::string::npos
+      && prometheus.str().find("lisp_allocations_total{kind=\"") != std::string::npos;
+    return check("metrics_output", ok);
+  }
+
+  // An exception leaving the interpreter is counted once, whatever its type
+  // and however deep it was thrown.
+  bool exceptions_counted() {
+    null_sink_t out;
+    interpreter_t interpreter("standart.lispam");
+    interpreter.set_output(out);
+    interpreter.register_function("at", [](std::vector<int64_t> xs, int64_t i) { return xs.at(i); });
+    auto count = [&interpreter](std::string_view code) {
+      auto before = runtime_stats.exceptions();
+      try {
+        interpreter.eval(code);
+      } catch (const std::exception&) { }
+      return runtime_stats.exceptions() - before;
+    };
+    bool ok = count("(def f (lambda (x) (head x))) (f ())") == 1
+      && count("(at (quote (1 2)) 5)") == 1
+      && count("(+ 1") == 1
+      && count("(+ 1 2)") == 0;
+    return check("exceptions_counted", ok);
+  }
+
+  // Records written before clear() are left out of the dump, the rings keep their heads.
+  bool trace_clear_drops_records() {
+    trace_t::value("before_clear", __LINE__, nullptr);
+    trace_t::clear();
+    auto path = temp_path("lisp_tests.trace");
+    bool ok = trace_t::dump(path);
+    std::ifstream ifs(path, std::ios::binary);
+    char magic[8] = {};
+    uint64_t names = 1, rings = 0;
+    ifs.read(magic, sizeof(magic));
+    ifs.read(reinterpret_cast<char*>(&names), sizeof(names));
+    ifs.read(reinterpret_cast<char*>(&rings), sizeof(rings));
+    for (uint64_t i = 0; ok && i < rings; i++) {
+      uint64_t thread = 0, count = 1;
+      ifs.read(reinterpret_cast<char*>(&thread), sizeof(thread));
+      ifs.read(reinterpret_cast<char*>(&count), sizeof(count));
+      ok = count == 0;
+    }
+    ok = ok && ifs && names == 0 && rings > 0;
+    std::filesystem::remove(path);
+    return check("trace_clear_drops_records", ok);
+  }
+
+  // println goes to the context's sink, fd_sink_t holds bytes until flush() or a full buffer.
+  bool sinks() {
+    memory_sink_t memory;
+    context_t ctx;
+    auto env = library(ctx);
+    ctx.out = &memory;
+    object_t::parse("(println \"a\") (println (cons 1 (cons 2 ())))")->eval(env, ctx);
+    bool ok = memory.str() == "\"a\"\n(1 2)\n";
+    memory.clear();
+    ok = ok && memory.str().empty();
+
+    null_sink_t null;
+    ctx.out = &null;
+    object_t::parse("(println 1)")->eval(env, ctx);
+    ok = ok && memory.str().empty();
+
+    auto path = temp_path("lisp_tests.sink");
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    {
+      fd_sink_t sink(fd, 8);
+      sink.write("abc");
+      ok = ok && std::filesystem::file_size(path) == 0;
+      sink.write("defgh\n");
+      ok = ok && std::filesystem::file_size(path) == 3;
+      sink.flush();
+      ok = ok && std::filesystem::file_size(path) == 9;
+      sink.write("0123456789"); // larger than the buffer, written through
+      ok = ok && std::filesystem::file_size(path) == 19;
+      sink.put('!');
+    }
+    ::close(fd);
+    std::ifstream ifs(path, std::ios::binary);
+    std::string text((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    ok = ok && text == "abcdefgh\n0123456789!";
+    std::filesystem::remove(path);
+    return check("sinks", ok);
+  }
+
+  // Lines written by write and write-line read back without the line break, also
+  // after the file is closed; read-record splits fields, fold-lines visits every line.
+  bool file_lines() {
+    auto path = temp_path("lisp_tests.lines");
+    context_t ctx;
+    auto env = library(ctx);
+    auto eval = [&env, &ctx](const std::string& code) { return object_t::parse(code)->eval(env, ctx)->show(); };
+    eval("(def path \"" + path + "\")");
+    eval("(def w (open path \"w\")) (write-line w \"a,b\") (write w \"c,,d\r\n\") (write-line w 42) (close w)");
+    bool ok = eval("(def r (open path \"r\")) (def line (read-line r)) line") == "\"a,b\""
+      && eval("(read-record r \",\")") == "(\"c\" \"\" \"d\")"
+      && eval("(read-line r)") == "\"42\""
+      && eval("(read-line r)") == "()"
+      && eval("(close r) line") == "\"a,b\""
+      && eval("(fold-lines (lambda (x n) (+ n 1)) 0 (open path \"r\"))") == "3";
+    std::filesystem::remove(path);
+    return check("file_lines", ok);
+  }
+
+  // Arguments and results of host functions are converted by their C++ types.
+  bool register_function_calls() {
+    null_sink_t out;
+    interpreter_t interpreter("standart.lispam");
+    interpreter.set_output(out);
+    int64_t calls = 0;
+    interpreter.register_function("scale", [](double x, int64_t n) { return x * n; });
+    interpreter.register_function("sum", [](std::vector<int64_t> xs) { return std::accumulate(xs.begin(), xs.end(), int64_t(0)); });
+    interpreter.register_function("join", [](const std::vector<std::string>& xs, std::string_view sep) {
+      std::string ret;
+      for (const auto& x : xs) ret += (ret.empty() ? "" : std::string(sep)) + x;
+      return ret;
+    });
+    interpreter.register_function("tick", [&calls]() { calls++; });
+
+    auto error = [&interpreter] (const char* code) -> std::string {
+      try {
+        interpreter.eval(code);
+      } catch (const std::exception& e) {
+        return e.what();
+      }
+      return "";
+    };
+    bool ok = interpreter.eval("(scale 2 3)")->show() == "6.0"
+      && interpreter.eval("(sum (range 0 5))")->show() == "10"
+      && interpreter.eval("(join (quote (\"a\" \"b\")) \",\")")->show() == "\"a,b\""
+      && interpreter.eval("(tick)")->show() == "()" && calls == 1
+      && interpreter.to<int64_t>(interpreter.eval("(sum (quote (1 2)))")) == 3
+      && error("(scale 1)") == "scale: expected 2 arguments"
+      && error("(scale \"a\" 1)") == "scale: argument #1 is not number"
+      && error("(scale 1.5 2.5)") == "scale: argument #2 is not int"
+      && error("(sum (quote (1 \"x\")))") == "sum: argument #1 is not int";
+
+    auto duplicate = [&interpreter] (const std::string& name) -> std::string {
+      try {
+        interpreter.register_function(name, [](int64_t x) { return x; });
+      } catch (const std::exception& e) {
+        return e.what();
+      }
+      return "";
+    };
+    ok = ok && duplicate("scale") == "env_base_t:defvar: value 'scale' is exists"
+      && duplicate("head") == "env_base_t:defvar: value 'head' is exists"
+      && interpreter.eval("(scale 2 3)")->show() == "6.0";
+    return check("register_function_calls", ok);
+  }
+
+  // Threads building the same hash-consed list share one object, cells freed
+  // by one thread while another looks them up are not revived.
+  bool hashcons_threads() {
+    std::vector<object_sptr_t> results(4);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < results.size(); i++) {
+      threads.emplace_back([&results, i] {
+        try {
+          null_sink_t out;
+          interpreter_t interpreter("standart.lispam");
+          interpreter.set_output(out);
+          interpreter.eval("(hash-consing true)");
+          results[i] = interpreter.eval("(foldl (lambda (x acc) (cons 1 (cons x (cons 3 ())))) () (range 0 3000))");
+        } catch (const std::exception&) {
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    bool ok = results[0] && results[0]->show() == "(1 2999 3)";
+    for (const auto& result : results) {
+      ok = ok && result == results[0];
+    }
+    return check("hashcons_threads", ok);
+  }
+
+  // Modes set by one interpreter don't change defs in another.
+  bool modes_are_per_interpreter() {
+    interpreter_t lazy("standart.lispam");
+    interpreter_t eager("standart.lispam");
+    lazy.eval("(lazy-defs true) (hash-consing true)");
+    bool ok = lazy.eval("(def y (+ 1 2))")->show() == "y" && eager.eval("(def y (+ 1 2))")->show() == "3"
+      && eager.eval("(hash-consing false)")->show() == "false";
+    return check("modes_are_per_interpreter", ok);
+  }
+
+  // A lazy def whose body throws something other than error_t is evaluated
+  // again on the next use instead of reporting a cycle.
+  bool lazy_def_retry() {
+    interpreter_t interpreter("standart.lispam");
+    int64_t calls = 0;
+    interpreter.register_function("flaky", [&calls]() -> int64_t {
+      if (!calls++) throw std::out_of_range("flaky: first call");
+      return 7;
+    });
+    interpreter.eval("(lazy-defs true) (def x (flaky))");
+    bool thrown = false;
+    try {
+      interpreter.eval("x");
+    } catch (const std::out_of_range&) {
+      thrown = true;
+    }
+    return check("lazy_def_retry", thrown && interpreter.eval("x")->show() == "7" && calls == 2);
+  }
+
+  // A failed force is rethrown with the def's name, and counted once.
+  bool lazy_def_error_counted() {
+    interpreter_t interpreter("standart.lispam");
+    interpreter.eval("(lazy-defs true) (def broken (head ()))");
+    auto exceptions = runtime_stats.exceptions();
+    std::string message;
+    try {
+      interpreter.eval("broken");
+    } catch (const std::exception& e) {
+      message = e.what();
+    }
+    return check("lazy_def_error_counted", message.starts_with("force: lazy def 'broken' at ")
+      && runtime_stats.exceptions() - exceptions == 1);
+  }
+
+  struct native_case_t {
+    const char* name;
+    bool (*test)();
+  };
+
+  std::vector<native_case_t> native_cases() {
+    return {
+      {"module_reload",             module_reload},
+      {"module_clash",              module_clash},
+      {"parse_chunked",             parse_chunked},
+      {"print_limits",              print_limits},
+      {"print_seq",                 print_seq},
+      {"seq_shared",                seq_shared},
+      {"deep_nesting",              deep_nesting},
+      {"load_data_forms",           load_data_forms},
+      {"profiler_output",           profiler_output},
+      {"profiler_reused_address",   profiler_reused_address},
+      {"metrics_output",            metrics_output},
+      {"exceptions_counted",        exceptions_counted},
+      {"trace_clear_drops_records", trace_clear_drops_records},
+      {"sinks",                     sinks},
+      {"file_lines",                file_lines},
+      {"register_function_calls",   register_function_calls},
+      {"hashcons_threads",          hashcons_threads},
+      {"modes_are_per_interpreter", modes_are_per_interpreter},
+      {"lazy_def_retry",            lazy_def_retry},
+      {"lazy_def_error_counted",    lazy_def_error_counted},
+    };
+  }
+
+}
+
+int main(int argc, char* argv[]) {
+  std::string filter = argc > 1 ? argv[1] : "";
+
+  size_t total = 0;
+  size_t failed = 0;
+  for (const auto& c : cases()) {
+    if (c.name.find(filter) == std::string::npos) continue;
+    total++;
+    failed += !run(c);
+  }
+  for (const auto& c : native_cases()) {
+    if (std::string(c.name).find(filter) == std::string::npos) continue;
+    total++;
+    try {
+      failed += !c.test();
+    } catch (const std::exception& e) {
+      std::cout << "FAIL " << c.name << "\n  error: " << e.what() << std::endl;
+      failed++;
+    }
+  }
+
+  std::cout << total - failed << "/" << total << " passed" << std::endl;
+  return failed ? 1 : 0;
+}
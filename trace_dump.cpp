@@ -0,0 +1,84 @@
+
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+
+#include "lisp_interpreter.h"
+
+
+
+// Formats a binary trace written by trace_t::dump.
+int main(int argc, char** argv) {
+  using namespace lisp_interpreter;
+
+  if (argc != 2) {
+    std::cerr << "usage: trace_dump FILE" << std::endl;
+    return 2;
+  }
+
+  std::ifstream ifs(argv[1], std::ios::binary);
+  auto read = [&ifs](void* data, size_t size) {
+    if (!ifs.read(static_cast<char*>(data), size)) throw std::runtime_error("trace_dump: unexpected EOF");
+  };
+  auto read_u64 = [&read] { uint64_t value; read(&value, sizeof(value)); return value; };
+
+  try {
+    char magic[sizeof(trace_t::magic)];
+    read(magic, sizeof(magic));
+    if (memcmp(magic, trace_t::magic, sizeof(magic))) throw std::runtime_error("trace_dump: bad magic");
+
+    std::map<uint64_t, std::string> names;
+    for (auto count = read_u64(); count--; ) {
+      auto id = read_u64();
+      std::string name(read_u64(), '\0');
+      read(name.data(), name.size());
+      names[id] = name;
+    }
+
+    for (auto rings = read_u64(); rings--; ) {
+      auto thread = read_u64();
+      auto count = read_u64();
+      std::cout << "thread " << std::hex << thread << std::dec << ": " << count << " records" << std::endl;
+
+      uint64_t start = 0;
+      int depth = 0;
+      for (uint64_t i = 0; i < count; i++) {
+        trace_record_t r;
+        read(&r, sizeof(r));
+        if (!i) start = r.time;
+        if (r.event != trace_record_t::enter && r.event != trace_record_t::value) depth = std::max(depth - 1, 0);
+
+        std::cout << std::setw(12) << r.time - start << " ns  " << std::string(depth * 2, ' ');
+        const auto& name = names[reinterpret_cast<uint64_t>(r.name)];
+        switch (r.event) {
+          case trace_record_t::enter:
+            std::cout << "> " << name << ':' << r.line;
+            depth++;
+            break;
+          case trace_record_t::exit:
+          case trace_record_t::exit_exception:
+            std::cout << "< " << name << (r.event == trace_record_t::exit_exception ? " *" : "");
+            break;
+          default:
+            std::cout << "  #" << r.line << ' ' << name << " = " << r.object;
+            if (r.kind != trace_record_t::no_kind) {
+              std::string kind = object_t::type_name(r.kind);
+              std::cout << ' ' << kind;
+              if (kind == "int") std::cout << ' ' << static_cast<int64_t>(r.payload);
+              if (kind == "double") std::cout << ' ' << std::bit_cast<double>(r.payload);
+              if (kind == "bool") std::cout << ' ' << (r.payload ? "true" : "false");
+            }
+            break;
+        }
+        std::cout << '\n';
+      }
+    }
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
+